@@ -0,0 +1,393 @@
+/*
+MIT License
+
+Copyright (c) [2020] [Ruben Cano Diaz]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+#pragma once
+#include <algorithm>
+#include <type_traits>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define MINIKERNELS_X86
+#define MINIKERNELS_AVX2   __attribute__((target("avx2,fma")))
+#define MINIKERNELS_AVX512 __attribute__((target("avx512f")))
+#endif
+
+//Kernels for the tiles of dense linear algebra tasks, in column major order as BLAS, for float and double.
+//The gemm micro-kernels are register blocked for AVX2 and AVX-512, the one used is chosen at runtime from the
+//processor (MINIKERNELS_ISA=scalar|avx2|avx512 in the environment restricts it). potrf, trsm and syrk are blocked
+//on top of gemm, so most of their work runs in the same micro-kernels.
+class MiniKernels
+{
+public:
+    enum isa_t { scalar, avx2, avx512 };
+
+private:
+    static constexpr int KC = 256;  //depth of the packed panels
+    static constexpr int MC = 128;  //rows of A packed at once, a multiple of every MR
+    static constexpr int NC = 4096; //columns of B packed at once
+    static constexpr int NB = 64;   //block size of potrf, trsm and syrk
+    static constexpr int maxTile = 32 * 12;
+
+    template<typename T>
+    struct gemm_kernel
+    {
+        int mr, nr;
+        void (*micro)(int kc, const T* a, const T* b, T* c, int ldc, T alpha); //C(mr x nr) += alpha * packed A * packed B
+    };
+
+    //Buffers of each thread for the packed panels, they only grow
+    template<typename T>
+    static T* buffer(int index, size_t count)
+    {
+        struct aligned_buffer
+        {
+            T*     data = nullptr;
+            size_t size = 0;
+            ~aligned_buffer() { ::operator delete(data, std::align_val_t(64)); }
+        };
+        static thread_local aligned_buffer buffers[3];
+
+        aligned_buffer& selected = buffers[index];
+        if (selected.size < count)
+        {
+            ::operator delete(selected.data, std::align_val_t(64));
+            selected.data = (T*)::operator new(count * sizeof(T), std::align_val_t(64));
+            selected.size = count;
+        }
+        return selected.data;
+    }
+
+    template<typename T>
+    static void microScalar(int kc, const T* a, const T* b, T* c, int ldc, T alpha)
+    {
+        T acc[4][4] = {};
+        for (int p = 0; p < kc; ++p, a += 4, b += 4)
+            for (int j = 0; j < 4; ++j)
+                for (int i = 0; i < 4; ++i)
+                    acc[j][i] += a[i] * b[j];
+        for (int j = 0; j < 4; ++j)
+            for (int i = 0; i < 4; ++i)
+                c[i + j * ldc] += alpha * acc[j][i];
+    }
+
+#if defined(MINIKERNELS_X86)
+    MINIKERNELS_AVX2 static inline __m256d avx2Zero(const double*) { return _mm256_setzero_pd(); }
+    MINIKERNELS_AVX2 static inline __m256  avx2Zero(const float*) { return _mm256_setzero_ps(); }
+    MINIKERNELS_AVX2 static inline __m256d avx2Load(const double* p) { return _mm256_load_pd(p); }
+    MINIKERNELS_AVX2 static inline __m256  avx2Load(const float* p) { return _mm256_load_ps(p); }
+    MINIKERNELS_AVX2 static inline __m256d avx2Broadcast(const double* p) { return _mm256_broadcast_sd(p); }
+    MINIKERNELS_AVX2 static inline __m256  avx2Broadcast(const float* p) { return _mm256_broadcast_ss(p); }
+    MINIKERNELS_AVX2 static inline __m256d avx2Fmadd(__m256d a, __m256d b, __m256d c) { return _mm256_fmadd_pd(a, b, c); }
+    MINIKERNELS_AVX2 static inline __m256  avx2Fmadd(__m256 a, __m256 b, __m256 c) { return _mm256_fmadd_ps(a, b, c); }
+    MINIKERNELS_AVX2 static inline void avx2Update(double* c, __m256d acc, double alpha) { _mm256_storeu_pd(c, _mm256_fmadd_pd(acc, _mm256_set1_pd(alpha), _mm256_loadu_pd(c))); }
+    MINIKERNELS_AVX2 static inline void avx2Update(float* c, __m256 acc, float alpha) { _mm256_storeu_ps(c, _mm256_fmadd_ps(acc, _mm256_set1_ps(alpha), _mm256_loadu_ps(c))); }
+
+    //Two vectors of rows by 6 columns, 12 accumulators of the 16 registers
+    template<typename T>
+    MINIKERNELS_AVX2 static void microAvx2(int kc, const T* a, const T* b, T* c, int ldc, T alpha)
+    {
+        constexpr int L = 32 / sizeof(T), NR = 6;
+        using vec = decltype(avx2Zero(a));
+        vec acc0[NR], acc1[NR];
+        #pragma GCC unroll 6
+        for (int j = 0; j < NR; ++j) acc0[j] = acc1[j] = avx2Zero(a);
+
+        for (int p = 0; p < kc; ++p, a += 2 * L, b += NR)
+        {
+            const vec a0 = avx2Load(a), a1 = avx2Load(a + L);
+            #pragma GCC unroll 6
+            for (int j = 0; j < NR; ++j)
+            {
+                const vec bj = avx2Broadcast(b + j);
+                acc0[j] = avx2Fmadd(a0, bj, acc0[j]);
+                acc1[j] = avx2Fmadd(a1, bj, acc1[j]);
+            }
+        }
+
+        #pragma GCC unroll 6
+        for (int j = 0; j < NR; ++j)
+        {
+            avx2Update(c + j * ldc, acc0[j], alpha);
+            avx2Update(c + j * ldc + L, acc1[j], alpha);
+        }
+    }
+
+    MINIKERNELS_AVX512 static inline __m512d avx512Zero(const double*) { return _mm512_setzero_pd(); }
+    MINIKERNELS_AVX512 static inline __m512  avx512Zero(const float*) { return _mm512_setzero_ps(); }
+    MINIKERNELS_AVX512 static inline __m512d avx512Load(const double* p) { return _mm512_load_pd(p); }
+    MINIKERNELS_AVX512 static inline __m512  avx512Load(const float* p) { return _mm512_load_ps(p); }
+    MINIKERNELS_AVX512 static inline __m512d avx512Broadcast(const double* p) { return _mm512_set1_pd(*p); }
+    MINIKERNELS_AVX512 static inline __m512  avx512Broadcast(const float* p) { return _mm512_set1_ps(*p); }
+    MINIKERNELS_AVX512 static inline __m512d avx512Fmadd(__m512d a, __m512d b, __m512d c) { return _mm512_fmadd_pd(a, b, c); }
+    MINIKERNELS_AVX512 static inline __m512  avx512Fmadd(__m512 a, __m512 b, __m512 c) { return _mm512_fmadd_ps(a, b, c); }
+    MINIKERNELS_AVX512 static inline void avx512Update(double* c, __m512d acc, double alpha) { _mm512_storeu_pd(c, _mm512_fmadd_pd(acc, _mm512_set1_pd(alpha), _mm512_loadu_pd(c))); }
+    MINIKERNELS_AVX512 static inline void avx512Update(float* c, __m512 acc, float alpha) { _mm512_storeu_ps(c, _mm512_fmadd_ps(acc, _mm512_set1_ps(alpha), _mm512_loadu_ps(c))); }
+
+    //Two vectors of rows by 12 columns, 24 accumulators of the 32 registers
+    template<typename T>
+    MINIKERNELS_AVX512 static void microAvx512(int kc, const T* a, const T* b, T* c, int ldc, T alpha)
+    {
+        constexpr int L = 64 / sizeof(T), NR = 12;
+        using vec = decltype(avx512Zero(a));
+        vec acc0[NR], acc1[NR];
+        #pragma GCC unroll 12
+        for (int j = 0; j < NR; ++j) acc0[j] = acc1[j] = avx512Zero(a);
+
+        for (int p = 0; p < kc; ++p, a += 2 * L, b += NR)
+        {
+            const vec a0 = avx512Load(a), a1 = avx512Load(a + L);
+            #pragma GCC unroll 12
+            for (int j = 0; j < NR; ++j)
+            {
+                const vec bj = avx512Broadcast(b + j);
+                acc0[j] = avx512Fmadd(a0, bj, acc0[j]);
+                acc1[j] = avx512Fmadd(a1, bj, acc1[j]);
+            }
+        }
+
+        #pragma GCC unroll 12
+        for (int j = 0; j < NR; ++j)
+        {
+            avx512Update(c + j * ldc, acc0[j], alpha);
+            avx512Update(c + j * ldc + L, acc1[j], alpha);
+        }
+    }
+#endif
+
+    template<typename T>
+    static const gemm_kernel<T>& kernel()
+    {
+        static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value, "MiniKernels supports float and double");
+        static const gemm_kernel<T> selected = []() -> gemm_kernel<T> {
+            #if defined(MINIKERNELS_X86)
+            if (isa() == avx512) return { 2 * 64 / (int)sizeof(T), 12, &microAvx512<T> };
+            if (isa() == avx2) return { 2 * 32 / (int)sizeof(T), 6, &microAvx2<T> };
+            #endif
+            return { 4, 4, &microScalar<T> };
+        }();
+        return selected;
+    }
+
+    //Slivers of mr rows, each one stored by columns, the rows past the end are zero
+    template<typename T>
+    static void packA(int mc, int kc, const T* A, int lda, int mr, T* packed)
+    {
+        for (int i0 = 0; i0 < mc; i0 += mr)
+        {
+            const int rows = std::min(mr, mc - i0);
+            for (int p = 0; p < kc; ++p, packed += mr)
+            {
+                const T* column = A + i0 + (size_t)p * lda;
+                int i = 0;
+                for (; i < rows; ++i) packed[i] = column[i];
+                for (; i < mr; ++i) packed[i] = T(0);
+            }
+        }
+    }
+
+    //Slivers of nr columns of op(B), each one stored by rows, the columns past the end are zero
+    template<typename T>
+    static void packB(bool transposeB, int kc, int nc, const T* B, int ldb, int nr, T* packed)
+    {
+        for (int j0 = 0; j0 < nc; j0 += nr)
+        {
+            const int columns = std::min(nr, nc - j0);
+            for (int p = 0; p < kc; ++p, packed += nr)
+            {
+                int j = 0;
+                if (transposeB) for (; j < columns; ++j) packed[j] = B[(j0 + j) + (size_t)p * ldb];
+                else for (; j < columns; ++j) packed[j] = B[p + (size_t)(j0 + j) * ldb];
+                for (; j < nr; ++j) packed[j] = T(0);
+            }
+        }
+    }
+
+    template<typename T>
+    static void potrfUnblocked(int n, T* A, int lda, int& info)
+    {
+        for (int j = 0; j < n; ++j)
+        {
+            T* column = A + (size_t)j * lda;
+            if (!(column[j] > T(0))) { info = j + 1; return; }
+            column[j] = std::sqrt(column[j]);
+            const T inverse = T(1) / column[j];
+            for (int i = j + 1; i < n; ++i) column[i] *= inverse;
+            for (int k = j + 1; k < n; ++k)
+            {
+                T* target = A + (size_t)k * lda;
+                const T factor = column[k];
+                for (int i = k; i < n; ++i) target[i] -= column[i] * factor;
+            }
+        }
+    }
+
+public:
+
+    static isa_t isa()
+    {
+        static const isa_t selected = []() {
+            isa_t best = scalar;
+            #if defined(MINIKERNELS_X86)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f")) best = avx512;
+            else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) best = avx2;
+            #endif
+            if (const char* forced = getenv("MINIKERNELS_ISA"))
+            {
+                if (strcmp(forced, "scalar") == 0) best = scalar;
+                else if (strcmp(forced, "avx2") == 0 && best == avx512) best = avx2;
+            }
+            return best;
+        }();
+        return selected;
+    }
+
+    static const char* isaName()
+    {
+        static const char* names[] = { "scalar", "avx2", "avx512" };
+        return names[isa()];
+    }
+
+    //C(m x n) += alpha * A(m x k) * op(B), where op(B) is B(k x n) or, if transposeB, the transpose of B(n x k)
+    template<typename T>
+    static void gemm(bool transposeB, int m, int n, int k, T alpha, const T* A, int lda, const T* B, int ldb, T* C, int ldc)
+    {
+        const gemm_kernel<T>& kern = kernel<T>();
+        const int mr = kern.mr, nr = kern.nr;
+        T* packedB = buffer<T>(0, (size_t)KC * ((std::min(n, NC) + nr - 1) / nr) * nr);
+        T* packedA = buffer<T>(1, (size_t)KC * MC);
+
+        for (int jc = 0; jc < n; jc += NC)
+        {
+            const int nc = std::min(NC, n - jc);
+            for (int pc = 0; pc < k; pc += KC)
+            {
+                const int kc = std::min(KC, k - pc);
+                packB(transposeB, kc, nc, transposeB ? B + jc + (size_t)pc * ldb : B + pc + (size_t)jc * ldb, ldb, nr, packedB);
+
+                for (int ic = 0; ic < m; ic += MC)
+                {
+                    const int mc = std::min(MC, m - ic);
+                    packA(mc, kc, A + ic + (size_t)pc * lda, lda, mr, packedA);
+
+                    for (int jr = 0; jr < nc; jr += nr)
+                    {
+                        const int columns = std::min(nr, nc - jr);
+                        for (int ir = 0; ir < mc; ir += mr)
+                        {
+                            const int rows = std::min(mr, mc - ir);
+                            const T* a = packedA + (size_t)ir * kc;
+                            const T* b = packedB + (size_t)jr * kc;
+                            T* c = C + (ic + ir) + (size_t)(jc + jr) * ldc;
+                            if (rows == mr && columns == nr)
+                            {
+                                kern.micro(kc, a, b, c, ldc, alpha);
+                                continue;
+                            }
+
+                            //Tiles on the edges are computed aside and only the valid part is added
+                            alignas(64) T edge[maxTile];
+                            std::fill(edge, edge + mr * nr, T(0));
+                            kern.micro(kc, a, b, edge, mr, alpha);
+                            for (int j = 0; j < columns; ++j)
+                                for (int i = 0; i < rows; ++i)
+                                    c[i + (size_t)j * ldc] += edge[i + j * mr];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    //Lower triangle of C(n x n) += alpha * A(n x k) * A^T, the upper triangle is not referenced
+    template<typename T>
+    static void syrk(int n, int k, T alpha, const T* A, int lda, T* C, int ldc)
+    {
+        for (int j = 0; j < n; j += NB)
+        {
+            const int nb = std::min(NB, n - j);
+            T* diagonal = buffer<T>(2, (size_t)nb * nb);
+            std::fill(diagonal, diagonal + nb * nb, T(0));
+            gemm(true, nb, nb, k, alpha, A + j, lda, A + j, lda, diagonal, nb);
+            for (int jj = 0; jj < nb; ++jj)
+                for (int ii = jj; ii < nb; ++ii)
+                    C[(j + ii) + (size_t)(j + jj) * ldc] += diagonal[ii + jj * nb];
+
+            if (j + nb < n) gemm(true, n - j - nb, nb, k, alpha, A + j + nb, lda, A + j, lda, C + (j + nb) + (size_t)j * ldc, ldc);
+        }
+    }
+
+    //B(m x n) = B * inverse(L^T), with L(n x n) lower triangular (dtrsm with side R, uplo L, trans T, diag N)
+    template<typename T>
+    static void trsm(int m, int n, const T* L, int ldl, T* B, int ldb)
+    {
+        for (int j = 0; j < n; j += NB)
+        {
+            const int nb = std::min(NB, n - j);
+            if (j > 0) gemm(true, m, nb, j, T(-1), B, ldb, L + j, ldl, B + (size_t)j * ldb, ldb);
+
+            for (int jj = j; jj < j + nb; ++jj)
+            {
+                T* x = B + (size_t)jj * ldb;
+                for (int p = j; p < jj; ++p)
+                {
+                    const T factor = L[jj + (size_t)p * ldl];
+                    const T* solved = B + (size_t)p * ldb;
+                    for (int i = 0; i < m; ++i) x[i] -= solved[i] * factor;
+                }
+                const T inverse = T(1) / L[jj + (size_t)jj * ldl];
+                for (int i = 0; i < m; ++i) x[i] *= inverse;
+            }
+        }
+    }
+
+    //Cholesky factorization A = L * L^T of the lower triangle, returns 0 or the order of the first minor that is not positive
+    template<typename T>
+    static int potrf(int n, T* A, int lda)
+    {
+        for (int j = 0; j < n; j += NB)
+        {
+            const int nb = std::min(NB, n - j);
+            T* diagonal = A + j + (size_t)j * lda;
+            if (j > 0) syrk(nb, j, T(-1), A + j, lda, diagonal, lda);
+
+            int info = 0;
+            potrfUnblocked(nb, diagonal, lda, info);
+            if (info != 0) return j + info;
+
+            if (j + nb < n)
+            {
+                T* below = A + (j + nb) + (size_t)j * lda;
+                if (j > 0) gemm(true, n - j - nb, nb, j, T(-1), A + j + nb, lda, A + j, lda, below, lda);
+                trsm(n - j - nb, nb, diagonal, lda, below, lda);
+            }
+        }
+        return 0;
+    }
+};
@@ -30,12 +30,78 @@ SOFTWARE.
 #include <functional>
 #include <unordered_map>
 #include <queue>
+#include <deque>
 #include <atomic>
 #include <set>
 #include <csignal>
 #include <mutex>
+#include <memory>
 #include <cassert>
+#include <exception>
+#include <stdexcept>
+#include <new>
+#include <cstddef>
+#include <tuple>
 #include <string.h>
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <condition_variable>
+#include <typeinfo>
+#include <optional>
+#include <array>
+#include <utility>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MINIRUN_NOINLINE __declspec(noinline)
+#else
+#define MINIRUN_NOINLINE __attribute__((noinline))
+#endif
+#if defined(__cpp_rtti) || defined(_CPPRTTI)
+#define MINIRUN_AUTO_INLINE
+#endif
+#if defined(__linux__)
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <fcntl.h>
+#define MINIRUN_FILE_IO
+#define MINIRUN_SIGNAL_DUMP
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#define MINIRUN_GROUP_EVENTFD
+#define MINIRUN_HUGE_PAGES
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define MINIRUN_IO_URING
+#if !defined(IORING_SQ_CQ_OVERFLOW)
+#define IORING_SQ_CQ_OVERFLOW (1U << 1)
+#endif
+#endif
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+#define MINIRUN_PERF_COUNTERS
+#endif
+#endif
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define MINIRUN_COROUTINES
+#endif
 
 class MiniRun
 {
@@ -43,7 +109,16 @@ class MiniRun
     class  lock_guard;
     class  ThreadPool;
     struct sentinel_access_type_counter;
+    struct dependency_access;
+    struct group_state;
     struct Task;
+public:
+    template<typename T> class Future;
+    class Executor;
+    #if defined(MINIRUN_COROUTINES)
+    class Coroutine;
+    #endif
+private:
 
     using task_fun_t = std::function<void()>;
     using task_fin_t = std::function<bool()>;
@@ -53,8 +128,17 @@ class MiniRun
     using group_t = uint32_t;                    //this decides the type of the groups, value 0 is reserved to default
     using num_tasks_t = intptr_t;                    //this limits the number of tasks that can be run at the same time
     using sentinel_map_type = std::unordered_map<uintptr_t, sentinel_access_type_counter>;//type of the map where we store the tracking
+    static constexpr size_t resultSlotSize = 4 * sizeof(void*); //results up to this size are stored inside the task record
+    static constexpr uint32_t noAnyIndex = (uint32_t)-1;
+    static constexpr size_t cacheLineSize = 64;
     static constexpr group_t defaultGroup = 0;
     static constexpr group_t maxGroup = (group_t)-1;
+    static constexpr size_t callSites = 256;
+    static constexpr size_t callSiteProbes = 8;
+    static constexpr size_t hugePageSize = 2 << 20;
+
+    template<typename T, typename = void> struct hasDepKey : std::false_type {};
+    template<typename T> struct hasDepKey<T, std::void_t<decltype(std::declval<const T&>().dep_key())>> : std::true_type {};
 
     #if !defined(getenv_s)
     static void getenv_s(size_t* size,char*  value, size_t valuesz,const char*  name)
@@ -74,6 +158,50 @@ class MiniRun
     #endif
     
 
+    //Limit of cpus of the cgroup of the process (v2 cpu.max or v1 cfs quota), 0 if there is none
+    static int cgroupCpuLimit()
+    {
+        #if defined(__linux__)
+        long long quota = -1, period = 0;
+        if (FILE* file = fopen("/sys/fs/cgroup/cpu.max", "r"))
+        {
+            char value[32];
+            if (fscanf(file, "%31s %lld", value, &period) == 2 && strcmp(value, "max") != 0) quota = atoll(value);
+            fclose(file);
+        }
+        else if (FILE* file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r"))
+        {
+            if (fscanf(file, "%lld", &quota) != 1) quota = -1;
+            fclose(file);
+            if (FILE* periodFile = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r"))
+            {
+                if (fscanf(periodFile, "%lld", &period) != 1) period = 0;
+                fclose(periodFile);
+            }
+        }
+        if (quota > 0 && period > 0) return (int)std::max<long long>((quota + period - 1) / period, 1);
+        #endif
+        return 0;
+    }
+
+    //Cpus the process can use: the hardware threads, restricted by the affinity mask and the cgroup quota. They are
+    //read once, refresh reads them again since the quota of a long running process may change.
+    static int availableCpus(bool refresh = false)
+    {
+        static std::atomic<int> cpus{ 0 };
+        if (refresh || cpus.load(std::memory_order_relaxed) == 0)
+        {
+            int available = std::max((int)std::thread::hardware_concurrency(), 1);
+            #if defined(__linux__)
+            cpu_set_t set;
+            if (sched_getaffinity(0, sizeof(set), &set) == 0) available = std::min(available, std::max(CPU_COUNT(&set), 1));
+            #endif
+            const int limit = cgroupCpuLimit();
+            cpus.store(limit > 0 ? std::min(available, limit) : available, std::memory_order_relaxed);
+        }
+        return cpus.load(std::memory_order_relaxed);
+    }
+
     static bool minirunDisabled()
     {
         static bool disabled = []() {
@@ -84,539 +212,4073 @@ class MiniRun
         return disabled;
     }
 
-    class SpinLock
+    //Hint to the processor that the thread is spinning, so the sibling hyperthread (maybe the lock holder) can run
+    static inline void cpuRelax()
     {
-        std::atomic_flag locked = ATOMIC_FLAG_INIT;
-    public:
-        inline void lock() { while (locked.test_and_set(std::memory_order_acquire)) { ; } }
-        inline void unlock() { locked.clear(std::memory_order_release); }
-    };
+        #if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+        #elif defined(_M_X64) || defined(_M_IX86)
+        _mm_pause();
+        #elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+        #else
+        std::this_thread::yield();
+        #endif
+    }
 
-    class SpinWithForceLock
+    //Sleeps until the word changes, std::atomic::wait is a futex on linux. Without it the thread just yields.
+    template<typename T>
+    static inline void sleepWhile(std::atomic<T>& word, T value)
     {
-        std::atomic_flag flag = ATOMIC_FLAG_INIT;
-        std::atomic_flag forced_flag = ATOMIC_FLAG_INIT;
+        #if defined(__cpp_lib_atomic_wait)
+        word.wait(value, std::memory_order_relaxed);
+        #else
+        if (word.load(std::memory_order_relaxed) == value) std::this_thread::yield();
+        #endif
+    }
 
-        #if !defined(__cpp_lib_atomic_flag_test)
-        std::atomic<bool> forced;
-        #endif 
+    template<typename T>
+    static inline void wakeSleepers(std::atomic<T>& word)
+    {
+        #if defined(__cpp_lib_atomic_wait)
+        word.notify_all();
+        #else
+        (void)word;
+        #endif
+    }
 
+    //Spins with the pause instruction, then backs off exponentially, spin() returns false when it is time to sleep
+    class backoff
+    {
+        static constexpr uint32_t spinRounds = 16;
+        static constexpr uint32_t maxPauses = 256;
+        uint32_t _rounds = 0;
+        uint32_t _pauses = 1;
     public:
-        SpinWithForceLock() = default;
-        SpinWithForceLock(const SpinLock&) = delete;
-        SpinWithForceLock& operator=(const SpinLock&) = delete;
+        inline bool spin()
+        {
+            if (_pauses > maxPauses) return false;
+            for (uint32_t i = 0; i < _pauses; ++i) cpuRelax();
+            if (++_rounds > spinRounds) _pauses *= 2;
+            return true;
+        }
+    };
 
-        bool try_lock()
+    //With MINIRUN_LOCK_STATS defined, the locks count their acquisitions and the time waited for them by site
+    enum class lock_site : uint8_t { threadPool, sentinelGroups, sentinelMap, groups, groupWaiters, groupException, taskNotify, preallocatedTasks, ioRing, other, count };
+
+    #if defined(MINIRUN_LOCK_STATS)
+    struct lock_site_stats
+    {
+        std::atomic<uint64_t> acquisitions{ 0 };
+        std::atomic<uint64_t> contended{ 0 };
+        std::atomic<uint64_t> waitNanoseconds{ 0 };
+        std::atomic<uint64_t> maxWaitNanoseconds{ 0 };
+
+        inline void recordWait(std::chrono::steady_clock::time_point start)
         {
-            #if defined(__cpp_lib_atomic_flag_test)
-            if (forced_flag.test(std::memory_order_relaxed)) return false;
-            #else 
-            if(forced) return false;
-            #endif
-            
-            return !flag.test_and_set(std::memory_order_acquire);
+            const uint64_t waited = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            contended.fetch_add(1, std::memory_order_relaxed);
+            waitNanoseconds.fetch_add(waited, std::memory_order_relaxed);
+            uint64_t max = maxWaitNanoseconds.load(std::memory_order_relaxed);
+            while (waited > max && !maxWaitNanoseconds.compare_exchange_weak(max, waited, std::memory_order_relaxed));
         }
+    };
+    static inline lock_site_stats& lockStats(lock_site site)
+    {
+        static lock_site_stats stats[(size_t)lock_site::count];
+        return stats[(size_t)site];
+    }
+    #endif
 
-        void lock()
+    //What a thread that runs tasks is doing, it is only updated while the dumps are enabled
+    struct thread_record
+    {
+        std::atomic<const char*>    kind{ "external" };
+        std::thread::id             id = std::this_thread::get_id();
+        std::atomic<const MiniRun*> runtime{ nullptr };
+        std::atomic<const char*>    label{ nullptr };
+        std::atomic<group_t>        group{ 0 };
+        std::atomic<int64_t>        since{ 0 }; //steady clock nanoseconds at the start of the task, 0 while idle
+
+        thread_record()
         {
-            while (forced_flag.test_and_set(std::memory_order_acquire))
-                ;
-            #if !defined(__cpp_lib_atomic_flag_test)
-                forced = true;
-            #endif 
+            std::lock_guard<std::mutex> guard(introspection().mtx);
+            introspection().threads.push_back(this);
+        }
+
+        ~thread_record() { unregister<thread_record*>(introspection().threads, this); }
+    };
+
+    struct perf_thread;
+
+    //Runtimes, executors and threads that the dumps visit. It is never destroyed, threads may exit after the statics.
+    struct introspection_registry
+    {
+        std::mutex                   mtx;
+        std::vector<thread_record*>  threads;
+        std::vector<MiniRun*>        runtimes;
+        std::vector<Executor*>       executors;
+        std::vector<perf_thread*>    perfThreads; //never freed, the report includes the threads that have exited
+        std::string                  path;
+        int                          pipe[2] = { -1, -1 };
+    };
+
+    static inline introspection_registry& introspection()
+    {
+        static introspection_registry* registry = new introspection_registry();
+        return *registry;
+    }
+
+    static inline std::atomic<bool> _dumpsEnabled{ false }; //the threads record their tasks and the sentinels count their accesses
+
+    static inline bool dumpEnabled()
+    {
+        return _dumpsEnabled.load(std::memory_order_relaxed);
+    }
+
+    static inline thread_record& currentThreadRecord()
+    {
+        static thread_local thread_record record;
+        return record;
+    }
+
+    static inline int64_t steadyNanoseconds()
+    {
+        return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //Cpu time of the calling thread, it does not count the time the thread was preempted. The steady clock without it.
+    static inline int64_t threadCpuNanoseconds()
+    {
+        #if defined(CLOCK_THREAD_CPUTIME_ID)
+        timespec now;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) == 0) return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+        #endif
+        return steadyNanoseconds();
+    }
+
+    template<typename T>
+    static inline void unregister(std::vector<T>& items, T item)
+    {
+        std::lock_guard<std::mutex> guard(introspection().mtx);
+        items.erase(std::find(items.begin(), items.end(), item));
+    }
+
+    //Label given to the tasks created by this thread, see task_label
+    static inline thread_local const char* _creationLabel = nullptr;
+
+    //Block of scratch memory, the blocks of an arena are chained and kept for reuse. The memory follows the header.
+    struct alignas(cacheLineSize) scratch_block
+    {
+        scratch_block* next;
+        char*          end;
+        size_t         bytes; //of the whole allocation
+        bool           mapped;
+
+        inline char* begin() { return (char*)(this + 1); }
+    };
+
+    //Position of a bump allocator, restoring it releases what was allocated after it
+    struct scratch_position
+    {
+        scratch_block* block;
+        char*          top;
+        char*          end;
+
+        scratch_position(scratch_block* block = nullptr, char* top = nullptr, char* end = nullptr) : block(block), top(top), end(end) {}
+    };
+
+    struct scratch_thread
+    {
+        scratch_position position;
+        scratch_block*   first;
+
+        scratch_thread() : first(nullptr) {}
+        ~scratch_thread() { deleteScratchBlocks(first); }
+    };
 
-            while (flag.test_and_set(std::memory_order_acquire))
-                ;
-            forced_flag.clear(std::memory_order_release);
+    static inline std::atomic<size_t> _scratchBlockBytes{ 1 << 20 };
+    static inline std::atomic<bool>   _scratchHugePages{ false };
+    static inline thread_local scratch_thread _scratch;
 
-            #if !defined(__cpp_lib_atomic_flag_test)
-                forced = false;
-            #endif 
+    static inline scratch_block* newScratchBlock(size_t bytes, scratch_block* next)
+    {
+        const bool huge = _scratchHugePages.load(std::memory_order_relaxed);
+        const size_t granularity = huge ? hugePageSize : 4096;
+        if (bytes > SIZE_MAX - sizeof(scratch_block) - granularity) throw std::bad_alloc();
+        bytes = std::max(bytes + sizeof(scratch_block), _scratchBlockBytes.load(std::memory_order_relaxed));
+        bytes = (bytes + granularity - 1) / granularity * granularity;
 
+        void* memory = nullptr;
+        #if defined(MINIRUN_HUGE_PAGES)
+        if (huge)
+        {
+            memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) memory = nullptr;
+            else madvise(memory, bytes, MADV_HUGEPAGE);
         }
-        void unlock()
+        #endif
+        const bool mapped = memory != nullptr;
+        if (!mapped) memory = ::operator new(bytes, std::align_val_t(cacheLineSize));
+        return new (memory) scratch_block{ next, (char*)memory + bytes, bytes, mapped };
+    }
+
+    static inline void deleteScratchBlocks(scratch_block* block)
+    {
+        while (block != nullptr)
         {
-            flag.clear(std::memory_order_release);
+            scratch_block* next = block->next;
+            #if defined(MINIRUN_HUGE_PAGES)
+            if (block->mapped) munmap(block, block->bytes);
+            else
+            #endif
+            ::operator delete(block, std::align_val_t(cacheLineSize));
+            block = next;
         }
-    };
+    }
 
-    class lock_guard
+    //Bumps the top of the current block, or moves to the next block, inserting a new one if that one is too small
+    static inline void* bumpScratch(scratch_position& position, scratch_block*& first, size_t count, size_t size, size_t alignment)
     {
-        SpinLock& _lock;
-    public:
-        inline lock_guard(SpinLock& lock) :_lock(lock)
+        assert(alignment != 0 && (alignment & (alignment - 1)) == 0 && "MiniRun: the alignment must be a power of two");
+        const uintptr_t mask = (uintptr_t)alignment - 1;
+        if (size != 0 && count > (SIZE_MAX - mask) / size) throw std::bad_array_new_length();
+        const size_t bytes = count * size;
+        if (position.block != nullptr)
         {
-            _lock.lock();
+            const uintptr_t top = ((uintptr_t)position.top + mask) & ~mask;
+            if (top <= (uintptr_t)position.end && bytes <= (uintptr_t)position.end - top)
+            {
+                position.top = (char*)(top + bytes);
+                return (void*)top;
+            }
         }
-        inline ~lock_guard()
+
+        scratch_block*& link = position.block != nullptr ? position.block->next : first;
+        uintptr_t top = link != nullptr ? ((uintptr_t)link->begin() + mask) & ~mask : 0;
+        if (link == nullptr || top > (uintptr_t)link->end || bytes > (uintptr_t)link->end - top)
         {
-            _lock.unlock();
+            link = newScratchBlock(bytes + mask, link);
+            top = ((uintptr_t)link->begin() + mask) & ~mask;
         }
-    };
+        position = { link, (char*)(top + bytes), link->end };
+        return (void*)top;
+    }
 
-    class ThreadPool
+    //Spins, backs off and then sleeps until it is released, the state tells the owner if it has to wake anyone
+    class SpinLock
     {
-        const int _processor_count = std::thread::hardware_concurrency();
-        bool _alive;
-        std::queue<Task*>     _runnable_tasks;
-        std::vector<std::thread> _threads;
-        SpinWithForceLock              _thread_pool_spinlock;
+        std::atomic<uint32_t> _state{ 0 }; //0 free, 1 taken, 2 taken and there may be threads sleeping
+        #if defined(MINIRUN_LOCK_STATS)
+        lock_site _site;
+        #endif
+    public:
+        SpinLock(lock_site site = lock_site::other)
+        {
+            #if defined(MINIRUN_LOCK_STATS)
+            _site = site;
+            #else
+            (void)site;
+            #endif
+        }
+        SpinLock(const SpinLock&) = delete;
+        SpinLock& operator=(const SpinLock&) = delete;
 
-        inline void worker()
+        inline bool try_lock()
         {
+            uint32_t expected = 0;
+            return _state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+        }
 
-            Task* task_to_run = nullptr;
-            {
+        //Takes the lock without recording statistics
+        inline void acquire()
+        {
+            if (try_lock()) return;
+            backoff wait;
+            while (wait.spin())
+                if (_state.load(std::memory_order_relaxed) == 0 && try_lock()) return;
+            while (_state.exchange(2, std::memory_order_acquire) != 0) sleepWhile(_state, 2u);
+        }
 
-                if (_thread_pool_spinlock.try_lock())
-                {
-                    if (!_runnable_tasks.empty())
-                    {
-                        task_to_run = _runnable_tasks.front();
-                        _runnable_tasks.pop();
-                    }
-                    _thread_pool_spinlock.unlock();
-                }
+        inline void lock()
+        {
+            #if defined(MINIRUN_LOCK_STATS)
+            lock_site_stats& stats = lockStats(_site);
+            stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+            if (try_lock()) return;
+            const auto start = std::chrono::steady_clock::now();
+            acquire();
+            stats.recordWait(start);
+            #else
+            acquire();
+            #endif
+        }
+
+        inline void unlock()
+        {
+            if (_state.exchange(0, std::memory_order_release) == 2)
+            {
+                #if defined(__cpp_lib_atomic_wait)
+                _state.notify_one();
+                #endif
             }
-            if (task_to_run != nullptr) (*task_to_run)();
-            else std::this_thread::yield();
         }
+    };
 
+    //The threads that call lock() take tickets and are served in order before the ones that only try to take it
+    class SpinWithForceLock
+    {
+        std::atomic<uint32_t> _nextTicket{ 0 };
+        std::atomic<uint32_t> _servingTicket{ 0 };
+        SpinLock              _lock;
 
-        inline void spawnThreads(size_t number)
+        inline void acquire(uint32_t ticket)
         {
-            for (size_t i = 0; i < number; ++i)
-                _threads.push_back(std::thread([&] {while (_alive) worker(); }));
-
+            backoff wait;
+            uint32_t serving;
+            while ((serving = _servingTicket.load(std::memory_order_acquire)) != ticket)
+                if (!wait.spin()) sleepWhile(_servingTicket, serving);
+            _lock.acquire();
         }
 
     public:
+        SpinWithForceLock() = default;
+        SpinWithForceLock(const SpinWithForceLock&) = delete;
+        SpinWithForceLock& operator=(const SpinWithForceLock&) = delete;
 
-        inline void runTaskExternalThread()
+        bool try_lock()
         {
-            worker();
+            if (_nextTicket.load(std::memory_order_relaxed) != _servingTicket.load(std::memory_order_relaxed)) return false;
+            return _lock.try_lock();
         }
 
-        inline void addTask(Task* task)
+        void lock()
         {
-            _thread_pool_spinlock.lock();
-            _runnable_tasks.emplace(task);
-            _thread_pool_spinlock.unlock();
+            const uint32_t ticket = _nextTicket.fetch_add(1, std::memory_order_relaxed);
+            #if defined(MINIRUN_LOCK_STATS)
+            lock_site_stats& stats = lockStats(lock_site::threadPool);
+            stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+            if (_servingTicket.load(std::memory_order_acquire) != ticket || !_lock.try_lock())
+            {
+                const auto start = std::chrono::steady_clock::now();
+                acquire(ticket);
+                stats.recordWait(start);
+            }
+            #else
+            acquire(ticket);
+            #endif
+            _servingTicket.store(ticket + 1, std::memory_order_release); //only the owner of the ticket being served moves it
+            wakeSleepers(_servingTicket);
         }
 
-        ThreadPool() : _alive(true)
+        void unlock()
         {
-            if (!MiniRun::minirunDisabled()) spawnThreads(_processor_count - 1);
+            _lock.unlock();
         }
+    };
 
-        ThreadPool(int numThreads) : _alive(true)
+    class lock_guard
+    {
+        SpinLock& _lock;
+    public:
+        inline lock_guard(SpinLock& lock) :_lock(lock)
         {
-            if (!MiniRun::minirunDisabled()) spawnThreads(numThreads);
+            _lock.lock();
         }
-
-        ~ThreadPool()
+        inline ~lock_guard()
         {
-            _alive = false;
-            for (auto& thread : _threads) thread.join();
+            _lock.unlock();
         }
-
     };
 
-    struct sentinel_access_type_counter
+    //The pool can be shared by several runtimes, each one is a client with its own queues, weight and quota
+    class ThreadPool
     {
-        struct block
+    public:
+        //The ready tasks are queued by group, the groups with ready tasks take turns by deficit round robin.
+        //The groups of the latency class go before the others. Everything is protected by the lock of the pool.
+        struct client
         {
-            Task* outTask;
-            num_tasks_t countdownToOut;
-            std::queue<Task*> _blockedTasks;
-            bool satisfied = false;
-            void increaseCountdown(Task* task = nullptr)
+            std::deque<group_state*> _readyGroups[2]; //latency class and normal class
+            std::atomic<size_t>      _readyTasks{ 0 }; //only written with the lock, read without it by the automatic inlining
+            num_tasks_t              _weight = 1;  //tasks taken from the client in each round
+            num_tasks_t              _quota = 0;   //maximum number of tasks of the client running in the pool threads, 0 is unlimited
+            std::atomic<num_tasks_t> _running{ 0 };
+            num_tasks_t              _deficit = 0;
+
+            inline void push(Task* task)
             {
-                countdownToOut++;
+                group_state* group = task->_groupState;
+                if (!group->hasReady()) _readyGroups[group->_latency ? 0 : 1].push_back(group);
+                group->pushReady(task);
+                _readyTasks.store(_readyTasks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
             }
 
-            void decreaseCountdown(Task* task = nullptr)
+            inline Task* pop()
             {
-                countdownToOut--;
+                for (auto& groups : _readyGroups)
+                {
+                    if (groups.empty()) continue;
+                    group_state* group = groups.front();
+                    if (group->_deficit <= 0) group->_deficit = group->_weight;
+                    Task* task = group->popReady();
+                    _readyTasks.store(_readyTasks.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+                    if (!group->hasReady())
+                    {
+                        group->_deficit = 0;
+                        groups.pop_front();
+                    }
+                    else if (--group->_deficit <= 0)
+                    {
+                        groups.pop_front();
+                        groups.push_back(group);
+                    }
+                    return task;
+                }
+                return nullptr;
             }
 
+            //A group with ready tasks moves to the queue of its new class
+            inline void setGroupScheduling(group_state& group, num_tasks_t weight, bool latency)
+            {
+                group._weight = weight;
+                if (group._latency == latency) return;
+                if (group.hasReady())
+                {
+                    auto& from = _readyGroups[group._latency ? 0 : 1];
+                    from.erase(std::find(from.begin(), from.end(), &group));
+                    _readyGroups[latency ? 0 : 1].push_back(&group);
+                }
+                group._latency = latency;
+            }
         };
 
-        std::deque<block>       _blocks;
-        SpinLock                _sentinel_mtx;
-
-        inline void _eraseBlock()
+    private:
+        //A worker leaves when its index is not below the number of threads, and its slot is reused when the pool grows
+        struct worker_slot
         {
-            if (_blocks.at(0).countdownToOut != 0)
-                abort();
-            _blocks.pop_front();
-        }
+            std::thread thread;
+            bool        running = false; //protected by the resize mutex
+        };
 
-        inline void _processNext()
-        {
-            if (_blocks.at(0).countdownToOut == 0)
-            {
+        //Automatic mode: every tick the pool grows when tasks have been waiting while all the workers were busy,
+        //and it shrinks by one worker after some ticks in a row with idle workers and no ready tasks
+        static constexpr auto autoTick = std::chrono::milliseconds(10);
+        static constexpr int  autoGrowTicks = 2;
+        static constexpr int  autoShrinkTicks = 50;
+        static constexpr int  autoCpuTicks = 100; //the cpus available are read again every second
 
-                if (_blocks.size() > 1 && _blocks.at(0).outTask == nullptr && _blocks.at(1).outTask != nullptr && !_blocks.at(1).satisfied)
-                {
-                    _blocks.at(1).satisfied = true;
-                    _blocks.at(1).outTask->decreaseCountdown();
+        std::atomic<bool> _alive;
+        std::vector<client*>     _clients;
+        size_t                   _next_client = 0;
+        SpinWithForceLock              _thread_pool_spinlock;
 
-                }
-            }
+        std::mutex                                _resizeMtx;
+        std::vector<std::unique_ptr<worker_slot>> _slots;
+        std::atomic<int>                          _numThreads{ 0 };
+        std::atomic<int>                          _busyThreads{ 0 };
 
-        }
-        inline void decreaseIn(Task* task = nullptr)
-        {
-            lock_guard guard(_sentinel_mtx);
-            _blocks.front().decreaseCountdown(task);
-            _processNext();
-        }
+        std::mutex              _modeMtx; //serializes the changes of mode, that stop and start the auto thread
+        std::mutex              _autoMtx;
+        std::condition_variable _autoCondition;
+        std::thread             _autoThread;
+        bool                    _autoMode = false; //protected by the auto mutex
+        int                     _autoMin = 0;
+        int                     _autoMax = 0;
+        int                     _autoLimit = -1;   //maximum asked for, -1 for the cpus available
 
-        inline void increaseIn(Task* task = nullptr)
+        //The maximum asked for, capped by the cpus available now, one of them is for the thread that waits
+        inline int autoMaximum() const
         {
-            lock_guard guard(_sentinel_mtx);
-            _blocks.back().increaseCountdown(task);
+            const int cpus = std::max(availableCpus(true) - 1, 1);
+            return std::max(_autoLimit < 0 ? cpus : std::min(_autoLimit, cpus), _autoMin);
         }
 
-        inline void processSingleOut()
+        //Weighted round robin between the clients that have tasks and have not reached their quota
+        inline Task* popTask(client*& owner)
         {
-            lock_guard guard(_sentinel_mtx);
-            _eraseBlock();
-            _blocks.front().outTask = nullptr;
-            while (!_blocks.front()._blockedTasks.empty())
+            for (size_t visited = 0; visited < _clients.size(); ++visited)
             {
-                _blocks.front()._blockedTasks.front()->decreaseCountdown();
-                _blocks.front()._blockedTasks.pop();
+                if (_next_client >= _clients.size()) _next_client = 0;
+                client* candidate = _clients[_next_client];
+
+                if (candidate->_readyTasks != 0 && (candidate->_quota == 0 || candidate->_running < candidate->_quota))
+                {
+                    if (candidate->_deficit <= 0) candidate->_deficit = candidate->_weight;
+                    Task* task = candidate->pop();
+                    if (--candidate->_deficit <= 0 || candidate->_readyTasks == 0) _next_client++;
+                    owner = candidate;
+                    owner->_running++;
+                    return task;
+                }
+
+                candidate->_deficit = 0;
+                _next_client++;
             }
-            _processNext();
+            return nullptr;
         }
-        inline void addTaskDep(Task* task, bool read)
+
+        inline void worker()
         {
-            lock_guard guard(_sentinel_mtx);
-            if (_blocks.size() == 0) _blocks.push_back({ nullptr,0 });
 
-            if (read)
+            Task* task_to_run = nullptr;
+            client* owner = nullptr;
             {
-                task->decreaseAfterExecution(this);
-                _blocks.back().increaseCountdown(task);
-                if (_blocks.size() > 1)
+
+                if (_thread_pool_spinlock.try_lock())
                 {
-                    task->increaseCountdown();
-                    _blocks.back()._blockedTasks.push(task);
+                    task_to_run = popTask(owner);
+                    _thread_pool_spinlock.unlock();
                 }
             }
+            if (task_to_run == nullptr) std::this_thread::yield();
             else
             {
-                _blocks.push_back({ task,0 });
-                task->increaseCountdown();
-                task->outAfterExecution(this);
+                _busyThreads.fetch_add(1, std::memory_order_relaxed);
+                while (task_to_run != nullptr) task_to_run = (*task_to_run)();
+                owner->_running--;
+                _busyThreads.fetch_sub(1, std::memory_order_relaxed);
             }
+        }
+
+        inline void workerLoop(int index)
+        {
+            currentThreadRecord().kind.store("worker", std::memory_order_relaxed);
+            while (true)
+            {
+                while (_alive && index < _numThreads.load(std::memory_order_relaxed)) worker();
 
-            _processNext();
+                //The pool may have grown again before this worker left
+                std::lock_guard<std::mutex> guard(_resizeMtx);
+                if (!_alive || index >= _numThreads.load(std::memory_order_relaxed))
+                {
+                    _slots[index]->running = false;
+                    return;
+                }
+            }
         }
 
-    };
+        inline size_t readyTasks()
+        {
+            _thread_pool_spinlock.lock();
+            size_t ready = 0;
+            for (client* owner : _clients) ready += owner->_readyTasks;
+            _thread_pool_spinlock.unlock();
+            return ready;
+        }
 
-    struct Task
-    {
-        MiniRun& _targetRuntime;
-        std::vector<Task*> _taskNotify;
-        std::vector<sentinel_access_type_counter*> _decreaseInCounterAfterExecution;
-        std::vector<sentinel_access_type_counter*> _processFinishOutAfterExecution;
+        inline void autoLoop()
+        {
+            int waitingTicks = 0, idleTicks = 0, cpuTicks = 0;
+            std::unique_lock<std::mutex> guard(_autoMtx);
+            while (_autoMode)
+            {
+                _autoCondition.wait_for(guard, autoTick);
+                if (!_autoMode) return;
+                if (++cpuTicks == autoCpuTicks)
+                {
+                    _autoMax = autoMaximum();
+                    cpuTicks = 0;
+                }
 
-        task_fun_fin_t       _fun_fin;
-        task_fun_t           _fun;
-        task_fin_t           _fin;
+                const int current = _numThreads.load(std::memory_order_relaxed);
+                const size_t ready = readyTasks();
+                const bool allBusy = _busyThreads.load(std::memory_order_relaxed) >= current;
 
-        bool                 _taskHasFinished;
-        bool                 _isFunFin;
-        bool                 _isAwaitingForFinalization;
-        bool                 _hasAsynchronousFinalization;
-        num_tasks_t          _countdownToRelease;
-        SpinLock             _countdownMtx;
-        group_t              _group;
+                waitingTicks = ready != 0 && allBusy ? waitingTicks + 1 : 0;
+                idleTicks = ready == 0 && !allBusy ? idleTicks + 1 : 0;
 
+                int target = std::min(std::max(current, _autoMin), _autoMax);
+                if (waitingTicks >= autoGrowTicks || (ready > (size_t)current && allBusy))
+                {
+                    target = std::min(std::max(target, current + std::max(current / 2, 1)), _autoMax);
+                    waitingTicks = 0;
+                }
+                else if (idleTicks >= autoShrinkTicks)
+                {
+                    target = std::max(std::min(target, current - 1), _autoMin);
+                    idleTicks = 0;
+                }
+                if (target != current) resize(target);
+            }
+        }
 
-        Task(MiniRun& ref) : _targetRuntime(ref), _taskHasFinished(false), _countdownToRelease(0)
+        inline void resize(int numThreads)
         {
-            _taskNotify.reserve(10);
-            _decreaseInCounterAfterExecution.reserve(10);
-            _processFinishOutAfterExecution.reserve(10);
+            std::lock_guard<std::mutex> guard(_resizeMtx);
+            if (MiniRun::minirunDisabled() || !_alive) return;
+            numThreads = std::max(numThreads, 0);
+            _numThreads = numThreads;
+            for (int i = 0; i < numThreads; ++i)
+            {
+                if ((size_t)i == _slots.size()) _slots.emplace_back(new worker_slot());
+                worker_slot& slot = *_slots[i];
+                if (slot.running) continue;
+                if (slot.thread.joinable()) slot.thread.join(); //it has already left
+                slot.running = true;
+                slot.thread = std::thread([this, i] { workerLoop(i); });
+            }
         }
 
-        inline void reinitialize()
+        inline void stopAuto()
         {
-            _taskNotify.clear();
-            _decreaseInCounterAfterExecution.clear();
-            _processFinishOutAfterExecution.clear();
-            _countdownToRelease = 0;
-            _taskHasFinished = false;
-            _hasAsynchronousFinalization = false;
-            _isAwaitingForFinalization = false;
-            _isFunFin = false;
+            {
+                std::lock_guard<std::mutex> guard(_autoMtx);
+                _autoMode = false;
+            }
+            _autoCondition.notify_all();
+            if (_autoThread.joinable() && _autoThread.get_id() != std::this_thread::get_id()) _autoThread.join();
         }
 
-        inline Task* prepare(const task_fun_t& async_fun, group_t group)
+    public:
+
+        //External threads only run tasks of their own runtime
+        inline void runTaskExternalThread(client* owner)
         {
-            reinitialize();
-            _fun = std::move(async_fun);
-            _group = group;
-            increaseCountdown();
-            return this;
+            Task* task_to_run = nullptr;
+            if (_thread_pool_spinlock.try_lock())
+            {
+                task_to_run = owner->pop();
+                _thread_pool_spinlock.unlock();
+            }
+            if (task_to_run == nullptr) std::this_thread::yield();
+            while (task_to_run != nullptr) task_to_run = (*task_to_run)();
         }
 
-        inline Task* prepare(const task_fun_t& async_fun, const task_fin_t& async_fin, group_t group)
+        inline void addTask(client* owner, Task* task)
         {
-            reinitialize();
-            _fun = std::move(async_fun);
-            _fin = std::move(async_fin);
-            _hasAsynchronousFinalization = true;
-            _group = group;
-            increaseCountdown();
-            return this;
+            _thread_pool_spinlock.lock();
+            owner->push(task);
+            _thread_pool_spinlock.unlock();
         }
 
-        inline Task* prepare(const task_fun_fin_t& async_fun_fin, group_t group)
+        inline void setGroupScheduling(client* owner, group_state& group, num_tasks_t weight, bool latency)
         {
-            reinitialize();
-            _fun_fin = std::move(async_fun_fin);
+            _thread_pool_spinlock.lock();
+            owner->setGroupScheduling(group, weight, latency);
+            _thread_pool_spinlock.unlock();
+        }
+
+        inline size_t readyTasks(group_state& group)
+        {
+            _thread_pool_spinlock.lock();
+            size_t ready = group._readyCount;
+            _thread_pool_spinlock.unlock();
+            return ready;
+        }
+
+        inline void attach(client* owner)
+        {
+            _thread_pool_spinlock.lock();
+            _clients.push_back(owner);
+            _thread_pool_spinlock.unlock();
+        }
+
+        //The client must have no pending tasks, waits for the workers that are still finishing one of them
+        inline void detach(client* owner)
+        {
+            _thread_pool_spinlock.lock();
+            _clients.erase(std::find(_clients.begin(), _clients.end(), owner));
+            _thread_pool_spinlock.unlock();
+            while (owner->_running != 0) std::this_thread::yield();
+        }
+
+        ThreadPool() : _alive(true)
+        {
+            resize(availableCpus() - 1);
+        }
+
+        ThreadPool(int numThreads) : _alive(true)
+        {
+            resize(numThreads);
+        }
+
+        ~ThreadPool()
+        {
+            std::lock_guard<std::mutex> mode(_modeMtx);
+            stopAuto();
+            _alive = false;
+            for (auto& slot : _slots)
+                if (slot->thread.joinable()) slot->thread.join();
+        }
+
+        inline int numThreads() const
+        {
+            return _numThreads.load(std::memory_order_relaxed);
+        }
+
+        //Leaves the automatic mode. The workers above the new number finish their current task and leave.
+        inline void setNumThreads(int numThreads)
+        {
+            std::lock_guard<std::mutex> mode(_modeMtx);
+            stopAuto();
+            resize(numThreads);
+        }
+
+        //A negative maximum is the cpus available, which are read again while the mode lasts
+        inline void setAutoThreads(int minThreads, int maxThreads)
+        {
+            std::lock_guard<std::mutex> mode(_modeMtx);
+            stopAuto();
+            int target;
+            {
+                std::lock_guard<std::mutex> guard(_autoMtx);
+                _autoMin = std::max(minThreads, 0);
+                _autoLimit = maxThreads;
+                _autoMax = autoMaximum();
+                _autoMode = true;
+                target = std::min(std::max(numThreads(), _autoMin), _autoMax);
+            }
+            resize(target);
+            _autoThread = std::thread([this] { autoLoop(); });
+        }
+
+    };
+
+#if defined(MINIRUN_FILE_IO)
+    //A transfer of an I/O task, the task polls it from its asynchronous finalization until it is done
+    struct io_request
+    {
+        bool              write;
+        int               fd;
+        off_t             offset;
+        iovec             buffer;
+        ssize_t           result = 0;      //bytes transferred or -errno
+        std::atomic<bool> done{ false };
+
+        inline void complete(ssize_t transferred)
+        {
+            result = transferred;
+            done.store(true, std::memory_order_release);
+        }
+
+        inline void runBlocking()
+        {
+            ssize_t transferred = write ? pwrite(fd, buffer.iov_base, buffer.iov_len, offset) : pread(fd, buffer.iov_base, buffer.iov_len, offset);
+            complete(transferred < 0 ? -errno : transferred);
+        }
+    };
+
+    //Submits the transfers to an io_uring when the kernel has it, otherwise they are run by a few threads that can block
+    //on them, so the workers never do. MINIRUN_IO_URING=0 in the environment forces the threads.
+    class IoEngine
+    {
+        static constexpr int fallbackThreads = 4;
+
+        std::mutex                _fallbackMtx;
+        std::condition_variable   _fallbackCondition;
+        std::queue<io_request*>   _fallbackRequests;
+        std::vector<std::thread>  _fallbackThreads;
+        bool                      _alive = true;
+
+        inline void fallbackWorker()
+        {
+            std::unique_lock<std::mutex> guard(_fallbackMtx);
+            while (true)
+            {
+                _fallbackCondition.wait(guard, [&] { return !_alive || !_fallbackRequests.empty(); });
+                if (_fallbackRequests.empty()) return;
+                io_request* request = _fallbackRequests.front();
+                _fallbackRequests.pop();
+                guard.unlock();
+                request->runBlocking();
+                guard.lock();
+            }
+        }
+
+        inline void submitFallback(io_request* request)
+        {
+            {
+                std::lock_guard<std::mutex> guard(_fallbackMtx);
+                if (_fallbackThreads.empty())
+                    for (int i = 0; i < fallbackThreads; ++i) _fallbackThreads.emplace_back([this] { fallbackWorker(); });
+                _fallbackRequests.push(request);
+            }
+            _fallbackCondition.notify_one();
+        }
+
+#if defined(MINIRUN_IO_URING)
+        static constexpr unsigned ringEntries = 256;
+
+        int           _ringFd = -1;
+        void*         _sqRing = MAP_FAILED;
+        void*         _cqRing = MAP_FAILED;
+        size_t        _sqRingSize = 0, _cqRingSize = 0, _sqesSize = 0;
+        unsigned*     _sqHead, *_sqTail, *_sqMask, *_sqFlags, *_sqArray;
+        unsigned*     _cqHead, *_cqTail, *_cqMask;
+        io_uring_sqe* _sqes = (io_uring_sqe*)MAP_FAILED;
+        io_uring_cqe* _cqes;
+        SpinLock      _submitMtx{ lock_site::ioRing };
+        SpinLock      _completeMtx{ lock_site::ioRing };
+
+        static bool ringDisabled()
+        {
+            static bool disabled = []() {
+                char value[8] = { 0 };
+                size_t requiredSize;
+                getenv_s(&requiredSize, value, sizeof(value), "MINIRUN_IO_URING");
+                return requiredSize != 0 && value[0] == '0';
+            }();
+            return disabled;
+        }
+
+        template<typename T>
+        static inline T* ringField(void* ring, __u32 offset) { return (T*)((char*)ring + offset); }
+
+        inline bool openRing()
+        {
+            io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            _ringFd = (int)syscall(__NR_io_uring_setup, ringEntries, &params);
+            if (_ringFd < 0) return false;
+
+            _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP) _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+            _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+            _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+            if (_sqRing == MAP_FAILED) return false;
+            _cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? _sqRing : mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+            if (_cqRing == MAP_FAILED) return false;
+            _sqes = (io_uring_sqe*)mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+            if (_sqes == MAP_FAILED) return false;
+
+            _sqHead = ringField<unsigned>(_sqRing, params.sq_off.head);
+            _sqTail = ringField<unsigned>(_sqRing, params.sq_off.tail);
+            _sqMask = ringField<unsigned>(_sqRing, params.sq_off.ring_mask);
+            _sqFlags = ringField<unsigned>(_sqRing, params.sq_off.flags);
+            _sqArray = ringField<unsigned>(_sqRing, params.sq_off.array);
+            _cqHead = ringField<unsigned>(_cqRing, params.cq_off.head);
+            _cqTail = ringField<unsigned>(_cqRing, params.cq_off.tail);
+            _cqMask = ringField<unsigned>(_cqRing, params.cq_off.ring_mask);
+            _cqes = ringField<io_uring_cqe>(_cqRing, params.cq_off.cqes);
+            return true;
+        }
+
+        inline void closeRing()
+        {
+            if (_sqes != MAP_FAILED) munmap(_sqes, _sqesSize);
+            if (_cqRing != MAP_FAILED && _cqRing != _sqRing) munmap(_cqRing, _cqRingSize);
+            if (_sqRing != MAP_FAILED) munmap(_sqRing, _sqRingSize);
+            if (_ringFd >= 0) close(_ringFd);
+            _ringFd = -1;
+        }
+
+        //Called with the submission lock, the entries the kernel could not take yet are retried on the next call
+        inline void enterRing(unsigned flags)
+        {
+            const unsigned pending = *_sqTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+            if (pending != 0 || flags != 0) syscall(__NR_io_uring_enter, _ringFd, pending, 0, flags, nullptr, 0);
+        }
+
+        inline bool submitRing(io_request* request)
+        {
+            lock_guard guard(_submitMtx);
+            const unsigned tail = *_sqTail;
+            if (tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) > *_sqMask) return false;
+
+            const unsigned index = tail & *_sqMask;
+            io_uring_sqe& sqe = _sqes[index];
+            memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = request->write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe.fd = request->fd;
+            sqe.addr = (__u64)(uintptr_t)&request->buffer;
+            sqe.len = 1;
+            sqe.off = (__u64)request->offset;
+            sqe.user_data = (__u64)(uintptr_t)request;
+            _sqArray[index] = index;
+            __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+            enterRing(0);
+            return true;
+        }
+#endif
+
+    public:
+        IoEngine()
+        {
+#if defined(MINIRUN_IO_URING)
+            if (ringDisabled() || !openRing()) closeRing();
+#endif
+        }
+
+        ~IoEngine()
+        {
+            {
+                std::lock_guard<std::mutex> guard(_fallbackMtx);
+                _alive = false;
+            }
+            _fallbackCondition.notify_all();
+            for (auto& thread : _fallbackThreads) thread.join();
+#if defined(MINIRUN_IO_URING)
+            closeRing();
+#endif
+        }
+
+        inline bool usesRing() const
+        {
+#if defined(MINIRUN_IO_URING)
+            return _ringFd >= 0;
+#else
+            return false;
+#endif
+        }
+
+        inline void submit(io_request* request)
+        {
+#if defined(MINIRUN_IO_URING)
+            if (usesRing() && submitRing(request)) return;
+#endif
+            submitFallback(request);
+        }
+
+        //Marks as done the requests in the completion queue, only one thread reaps it at a time
+        inline void poll()
+        {
+#if defined(MINIRUN_IO_URING)
+            if (!usesRing() || !_completeMtx.try_lock()) return;
+            unsigned head = *_cqHead;
+            const unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head)
+            {
+                const io_uring_cqe& cqe = _cqes[head & *_cqMask];
+                ((io_request*)(uintptr_t)cqe.user_data)->complete(cqe.res);
+            }
+            __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+            _completeMtx.unlock();
+
+            //Entries not taken by the kernel and completions that did not fit in the queue are flushed
+            const bool overflow = (__atomic_load_n(_sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) != 0;
+            if (overflow || __atomic_load_n(_sqTail, __ATOMIC_RELAXED) != __atomic_load_n(_sqHead, __ATOMIC_RELAXED))
+            {
+                lock_guard guard(_submitMtx);
+                enterRing(overflow ? IORING_ENTER_GETEVENTS : 0);
+            }
+#endif
+        }
+    };
+#endif
+
+    //Array stored inside its owner that only goes to the heap past N elements, for trivially copyable types
+    template<typename T, size_t N>
+    class small_vector
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "small_vector only holds trivially copyable types");
+
+        T*     _data;
+        size_t _size;
+        size_t _capacity;
+        T      _inline[N];
+
+    public:
+        small_vector() : _data(_inline), _size(0), _capacity(N) {}
+        small_vector(const small_vector&) = delete;
+        small_vector& operator=(const small_vector&) = delete;
+        ~small_vector() { if (_data != _inline) delete[] _data; }
+
+        inline void reserve(size_t capacity)
+        {
+            if (capacity <= _capacity) return;
+            T* data = new T[capacity];
+            memcpy((void*)data, (const void*)_data, _size * sizeof(T));
+            if (_data != _inline) delete[] _data;
+            _data = data;
+            _capacity = capacity;
+        }
+
+        inline void push_back(const T& value)
+        {
+            if (_size == _capacity) reserve(_capacity * 2);
+            _data[_size++] = value;
+        }
+
+        inline T& back() { return _data[_size - 1]; }
+        inline void clear() { _size = 0; }
+        inline size_t size() const { return _size; }
+        inline T* begin() { return _data; }
+        inline T* end() { return _data + _size; }
+    };
+
+    //Array stored inside its owner whose elements are not moved once pushed, it only goes to the heap past N elements
+    //and keeps the heap storage for the next time the owner is reused
+    template<typename T, size_t N>
+    class inline_array
+    {
+        T*     _data;
+        size_t _size;
+        size_t _capacity;
+        T      _inline[N];
+
+    public:
+        inline_array() : _data(_inline), _size(0), _capacity(N) {}
+        inline_array(const inline_array&) = delete;
+        inline_array& operator=(const inline_array&) = delete;
+        ~inline_array() { if (_data != _inline) delete[] _data; }
+
+        //Must be called while the array is empty
+        inline void reserve(size_t capacity)
+        {
+            if (capacity <= _capacity) return;
+            if (_data != _inline) delete[] _data;
+            _data = new T[capacity];
+            _capacity = capacity;
+        }
+
+        inline T& push() { assert(_size < _capacity); return _data[_size++]; }
+        inline void clear() { _size = 0; }
+        inline size_t size() const { return _size; }
+        inline T* begin() { return _data; }
+        inline T* end() { return _data + _size; }
+    };
+
+    //Access of a task to an address. The accesses to an address are chained in registration order, and each one
+    //forwards to the next the permissions to read and to write once it holds them and its task no longer needs them.
+    //All the state of an access is in its flags, so the chain is updated with atomic operations only.
+    struct dependency_access
+    {
+        enum : uint8_t
+        {
+            receivedRead   = 1,  //the previous writes have finished
+            receivedWrite  = 2,  //all the previous accesses have finished
+            complete       = 4,  //the task has finished
+            hasNext        = 8,  //next has been set
+            forwardedRead  = 16,
+            forwardedWrite = 32,
+            settled        = 64, //no thread is going to remove the access from the sentinel
+            all            = 127
+        };
+
+        std::atomic<uint8_t>          flags;
+        bool                          read;
+        bool                          counted; //registered while the dumps were enabled, it is counted by the sentinel
+        Task*                         task;
+        sentinel_access_type_counter* sentinel;
+        dependency_access*            next;
+
+        inline void reset(Task* accessTask, sentinel_access_type_counter* accessSentinel, bool isRead)
+        {
+            flags.store(0, std::memory_order_relaxed);
+            read = isRead;
+            counted = false;
+            task = accessTask;
+            sentinel = accessSentinel;
+            next = nullptr;
+        }
+
+        static inline bool idle(uint8_t f) { return (f & (receivedRead | receivedWrite | complete)) == (receivedRead | receivedWrite | complete); }
+        static inline bool readable(uint8_t f) { return (f & (receivedRead | receivedWrite)) != 0; }
+
+        //Each access holds a reference to its task that is released by the thread that makes its flags reach all,
+        //or by the thread that removes it from the sentinel. A thread only reads an access after changing its flags
+        //if it is that thread, the permissions forwarded to the next access are applied in the same loop.
+        inline void update(uint8_t bits)
+        {
+            dependency_access* access = this;
+            while (access != nullptr)
+            {
+                Task* const task = access->task;
+                const bool read = access->read;
+                const bool counted = access->counted;
+                sentinel_access_type_counter* const sentinel = access->sentinel;
+                const auto satisfied = [read](uint8_t f) { return read ? readable(f) : (f & receivedWrite) != 0; };
+
+                dependency_access* next = nullptr;
+                uint8_t previous = access->flags.load(std::memory_order_acquire), current;
+                do
+                {
+                    current = previous | bits;
+                    if (current & hasNext)
+                    {
+                        next = access->next;
+                        if (readable(current) && (read || (current & complete))) current |= forwardedRead;
+                        if ((current & receivedWrite) && (current & complete)) current |= forwardedWrite;
+                        if (idle(current) && !idle(previous)) current |= settled;
+                    }
+                } while (!access->flags.compare_exchange_weak(previous, current, std::memory_order_acq_rel, std::memory_order_acquire));
+
+                if (satisfied(current) && !satisfied(previous)) task->decreaseCountdown();
+
+                if (counted && idle(current) && !idle(previous)) sentinel->_completed.fetch_add(1, std::memory_order_relaxed);
+
+                if (current == all && previous != all) task->releaseReference();
+                else if (idle(current) && !idle(previous) && !(current & hasNext))
+                {
+                    //The last access of the sentinel leaves it empty, unless a new access is being linked to it
+                    dependency_access* expected = access;
+                    if (!sentinel->_last.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel))
+                    {
+                        bits = settled;
+                        continue;
+                    }
+                    task->releaseReference();
+                }
+
+                const uint8_t forwarded = current & ~previous & (forwardedRead | forwardedWrite);
+                bits = ((forwarded & forwardedRead) ? receivedRead : 0) | ((forwarded & forwardedWrite) ? receivedWrite : 0);
+                access = bits != 0 ? next : nullptr;
+            }
+        }
+    };
+
+    struct sentinel_access_type_counter
+    {
+        std::atomic<dependency_access*> _last{ nullptr }; //last access registered to the address, null when there is none pending
+        std::atomic<uint32_t>           _registered{ 0 }; //accesses registered and finished while the dumps are enabled
+        std::atomic<uint32_t>           _completed{ 0 };
+
+        inline void addTaskDep(dependency_access* access)
+        {
+            if (dumpEnabled())
+            {
+                access->counted = true;
+                _registered.fetch_add(1, std::memory_order_relaxed);
+            }
+            dependency_access* previous = _last.exchange(access, std::memory_order_acq_rel);
+            if (previous == nullptr)
+            {
+                access->update(dependency_access::receivedRead | dependency_access::receivedWrite);
+            }
+            else
+            {
+                previous->next = access;
+                previous->update(dependency_access::hasNext);
+            }
+        }
+    };
+
+    //Buffer whose writers get a free copy (version) when the current one still has pending accesses, the readers
+    //created after them read the new version. The last version is copied back to the original at taskwait.
+    struct renamed_buffer
+    {
+        dep_t              original;
+        size_t             bytes;
+        size_t             maxVersions;   //including the original
+        dep_t              current;
+        std::vector<dep_t> versions;      //allocated copies
+
+        renamed_buffer(dep_t buffer, size_t size, size_t max) : original(buffer), bytes(size), maxVersions(std::max<size_t>(max, 1)), current(buffer) {}
+        renamed_buffer(const renamed_buffer&) = delete;
+        renamed_buffer& operator=(const renamed_buffer&) = delete;
+        ~renamed_buffer() { for (dep_t version : versions) ::operator delete((void*)version, std::align_val_t(cacheLineSize)); }
+
+        inline void restore()
+        {
+            if (current == original) return;
+            memcpy((void*)original, (const void*)current, bytes);
+            current = original;
+        }
+    };
+
+    struct renaming_table
+    {
+        SpinLock                                   mtx;
+        std::unordered_map<dep_t, renamed_buffer>  buffers;
+    };
+
+    //Mean duration of the tasks created by a call site, the site is identified by the type of its function object
+    struct call_site
+    {
+        static constexpr uint32_t minSamples = 8;
+
+        std::atomic<const std::type_info*> type{ nullptr };
+        std::atomic<int64_t>  meanNanos{ 0 };
+        std::atomic<uint32_t> samples{ 0 };
+
+        //Moving average, concurrent updates may lose a sample. The samples are clamped, so a task that was preempted
+        //does not keep the site out for long.
+        inline void record(int64_t nanos, int64_t threshold)
+        {
+            nanos = std::min(nanos, 4 * threshold);
+            const uint32_t count = samples.load(std::memory_order_relaxed);
+            const int64_t mean = meanNanos.load(std::memory_order_relaxed);
+            meanNanos.store(count == 0 ? nanos : mean + (nanos - mean) / 8, std::memory_order_relaxed);
+            if (count < minSamples) samples.store(count + 1, std::memory_order_relaxed);
+        }
+
+        inline bool isShorterThan(int64_t nanos) const
+        {
+            return samples.load(std::memory_order_relaxed) >= minSamples && meanNanos.load(std::memory_order_relaxed) < nanos;
+        }
+    };
+
+    //Cpu time per iteration of the parallel_for tasks of a call site with auto_grain, moving average of the tasks
+    struct grain_site
+    {
+        std::atomic<double> nanosPerIteration{ 0 };
+
+        inline void record(unsigned long long iterations, int64_t nanos)
+        {
+            const double sample = (double)nanos / (double)iterations;
+            const double mean = nanosPerIteration.load(std::memory_order_relaxed);
+            nanosPerIteration.store(mean == 0 ? sample : mean + (sample - mean) / 4, std::memory_order_relaxed);
+        }
+    };
+
+    struct group_state
+    {
+        std::atomic<num_tasks_t> _running;
+        std::atomic<bool>        _cancelled;
+        SpinLock                 _exception_mtx{ lock_site::groupException };
+        std::exception_ptr       _exception;     //first exception thrown by a task of the group, rethrown at taskwait
+        SpinLock                 _waiters_mtx{ lock_site::groupWaiters };
+        std::vector<Task*>       _waiters;       //held tasks released when the group has no running tasks
+        int                      _eventFd = -1;  //written when the group has no running tasks, see completionFd
+
+        //Ready tasks and scheduling of the group, protected by the lock of the pool. The tasks are linked through
+        //their _nextReady, so the group allocates nothing for them.
+        Task*                    _readyHead = nullptr;
+        Task*                    _readyTail = nullptr;
+        size_t                   _readyCount = 0;
+        num_tasks_t              _weight = 1;    //tasks taken from the group in each round
+        num_tasks_t              _deficit = 0;
+        bool                     _latency = false;
+
+        std::atomic<renaming_table*> _renaming{ nullptr }; //created by the first enableRenaming of the group
+
+        group_state() : _running(0), _cancelled(false) {}
+        ~group_state()
+        {
+            delete _renaming.load();
+            #if defined(MINIRUN_GROUP_EVENTFD)
+            if (_eventFd != -1) close(_eventFd);
+            #endif
+        }
+
+        inline bool hasReady() const { return _readyHead != nullptr; }
+
+        inline void pushReady(Task* task)
+        {
+            task->_nextReady = nullptr;
+            if (_readyTail != nullptr) _readyTail->_nextReady = task;
+            else _readyHead = task;
+            _readyTail = task;
+            ++_readyCount;
+        }
+
+        inline Task* popReady()
+        {
+            Task* task = _readyHead;
+            _readyHead = task->_nextReady;
+            if (_readyHead == nullptr) _readyTail = nullptr;
+            --_readyCount;
+            return task;
+        }
+
+        //Called when the group has no running tasks
+        inline void restoreRenamed()
+        {
+            renaming_table* renaming = _renaming.load(std::memory_order_acquire);
+            if (renaming == nullptr) return;
+            lock_guard guard(renaming->mtx);
+            for (auto& buffer : renaming->buffers) buffer.second.restore();
+        }
+
+        //Returns false if the group is already empty, the task is not kept in that case
+        inline bool addWaiter(Task* task)
+        {
+            lock_guard guard(_waiters_mtx);
+            if (_running == 0) return false;
+            _waiters.push_back(task);
+            return true;
+        }
+
+        inline void releaseWaiters()
+        {
+            std::vector<Task*> waiters;
+            int eventFd;
+            {
+                lock_guard guard(_waiters_mtx);
+                if (_running != 0) return; //new tasks were created in the meantime
+                waiters.swap(_waiters);
+                eventFd = _eventFd;
+            }
+            if (eventFd != -1) signalEventFd(eventFd);
+            for (Task* task : waiters) task->decreaseCountdown();
+        }
+
+        //Creates the descriptor the first time, it is readable already if the group is empty. -1 with errno on failure.
+        inline int eventFd()
+        {
+            #if defined(MINIRUN_GROUP_EVENTFD)
+            lock_guard guard(_waiters_mtx);
+            if (_eventFd == -1)
+            {
+                _eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                if (_eventFd != -1 && _running == 0) signalEventFd(_eventFd);
+            }
+            #endif
+            return _eventFd;
+        }
+
+        static inline void signalEventFd(int eventFd)
+        {
+            #if defined(MINIRUN_GROUP_EVENTFD)
+            const uint64_t one = 1;
+            ssize_t written = write(eventFd, &one, sizeof(one)); //only fails if the counter would overflow, it is readable then
+            (void)written;
+            #else
+            (void)eventFd;
+            #endif
+        }
+
+        //Ends a wait that found the group empty, rethrows the first exception thrown by one of its tasks
+        inline void endTaskwait()
+        {
+            restoreRenamed();
+            _cancelled = false;
+            if (std::exception_ptr exception = takeException()) std::rethrow_exception(exception);
+        }
+
+        inline void captureException(std::exception_ptr exception)
+        {
+            lock_guard guard(_exception_mtx);
+            if (!_exception) _exception = exception;
+        }
+
+        inline std::exception_ptr takeException()
+        {
+            lock_guard guard(_exception_mtx);
+            std::exception_ptr exception = _exception;
+            _exception = nullptr;
+            return exception;
+        }
+    };
+
+    //Fields written on creation and read by the thread that runs the task go first, the ones updated by the
+    //threads that release the task or wait for it are kept in their own cache line
+    struct alignas(cacheLineSize) Task
+    {
+        struct successor
+        {
+            Task*    task;
+            uint32_t anyIndex; //noAnyIndex unless the successor is released by the first of its predecessors (when_any)
+        };
+
+        struct renaming
+        {
+            dep_t original;
+            dep_t version;
+        };
+
+        MiniRun&             _targetRuntime;
+        task_fun_t           _fun;
+        task_fin_t           _fin;
+        group_state*         _groupState;
+        const char*          _label;      //shown in the dumps, it must outlive the task
+        Executor*            _executor;   //the task only runs in the threads of the executor, all the threads of the pool if null
+        Task*                _nextReady;  //in the ready queue of its group, see group_state
+        Task*                _enclosing;  //task running in the thread that runs this one in place, see runUndeferred
+        call_site*           _site;       //measured for the automatic inlining, null if it is not enabled
+        group_t              _group;
+        bool                 _isAwaitingForFinalization;
+        bool                 _hasAsynchronousFinalization;
+        bool                 _ignoresCancellation;
+        bool                 _hasResult;
+        bool                 _undeferred; //run by the thread that created it once it is ready, see if_clause
+        bool                 _final;      //the tasks created while it runs are run inline, see final_clause
+        inline_array<dependency_access, 3> _accesses;
+
+        //The record is recycled when the last reference is released, futures keep their task (and its result) alive
+        void                (*_destroyResult)(Task*);
+        std::exception_ptr    _resultException;
+        alignas(std::max_align_t) unsigned char _result[resultSlotSize];
+
+        alignas(cacheLineSize) std::atomic<num_tasks_t> _countdownToRelease;
+        std::atomic<int>      _references;
+        std::atomic<uint32_t> _anyWinner;
+        std::atomic<bool>     _taskHasFinished;
+        std::atomic<bool>     _undeferredReady;
+        SpinLock              _notifyMtx{ lock_site::taskNotify };
+        small_vector<successor, 1> _taskNotify;
+        small_vector<renaming, 1>  _renamed;  //versions of the renamed buffers used by the task
+
+
+        Task(MiniRun& ref) : _targetRuntime(ref), _destroyResult(nullptr), _countdownToRelease(0), _references(0), _taskHasFinished(false), _undeferredReady(false)
+        {
+        }
+
+        inline void reinitialize()
+        {
+            _taskNotify.clear();
+            _renamed.clear();
+            _accesses.clear();
+            _countdownToRelease = 0;
+            _taskHasFinished = false;
+            _hasAsynchronousFinalization = false;
+            _isAwaitingForFinalization = false;
+            _ignoresCancellation = false;
+            _references = 1;
+            _anyWinner = noAnyIndex;
+            _hasResult = false;
+            _executor = nullptr;
+            _site = nullptr;
+            _undeferred = false;
+            _undeferredReady = false;
+            _enclosing = nullptr;
+            _final = false;
+            _label = _creationLabel;
+        }
+
+        inline Task* prepare(task_fun_t&& async_fun, group_t group)
+        {
+            reinitialize();
+            _fun = std::move(async_fun);
+            _group = group;
+            increaseCountdown();
+            return this;
+        }
+
+        inline Task* prepare(task_fun_t&& async_fun, task_fin_t&& async_fin, group_t group)
+        {
+            reinitialize();
+            _fun = std::move(async_fun);
+            _fin = std::move(async_fin);
+            _hasAsynchronousFinalization = true;
+            _group = group;
+            increaseCountdown();
+            return this;
+        }
+
+        //The activator stores the finalization it generates, so a single function object is kept
+        inline Task* prepare(task_fun_fin_t&& async_fun_fin, group_t group)
+        {
+            reinitialize();
+            _fun = [this, async_fun_fin = std::move(async_fun_fin)] { _fin = async_fun_fin(); };
             _hasAsynchronousFinalization = true;
-            _isFunFin = true;
             _group = group;
-            increaseCountdown();
-            return this;
+            increaseCountdown();
+            return this;
+        }
+
+
+        inline void activate()
+        {
+            decreaseCountdown();
+        }
+
+        //Runs a piece of user code, an exception is stored in the group to be rethrown at taskwait
+        template<typename F>
+        inline bool runGuarded(const F& fun)
+        {
+            try
+            {
+                fun();
+                return true;
+            }
+            catch (...)
+            {
+                _groupState->captureException(std::current_exception());
+                return false;
+            }
+        }
+
+        template<typename T>
+        static constexpr bool isResultInline = sizeof(T) <= resultSlotSize && alignof(T) <= alignof(std::max_align_t);
+
+        template<typename T>
+        inline T& result()
+        {
+            if constexpr (isResultInline<T>) return *std::launder(reinterpret_cast<T*>(_result));
+            else return **std::launder(reinterpret_cast<T**>(_result));
+        }
+
+        //Results that do not fit in the record are stored in the heap
+        template<typename T, typename V>
+        inline void setResult(V&& value)
+        {
+            if constexpr (isResultInline<T>)
+            {
+                new (_result) T(std::forward<V>(value));
+                _destroyResult = [](Task* task) { task->result<T>().~T(); };
+            }
+            else
+            {
+                new (_result) T*(new T(std::forward<V>(value)));
+                _destroyResult = [](Task* task) { delete &task->result<T>(); };
+            }
+        }
+
+        //Body of a value returning task, the exception is kept for the future instead of the group
+        template<typename T, typename F>
+        inline void runForResult(F&& fun)
+        {
+            _hasResult = true;
+            try
+            {
+                if constexpr (std::is_void<T>::value) fun();
+                else setResult<T>(fun());
+            }
+            catch (...)
+            {
+                _resultException = std::current_exception();
+            }
+        }
+
+        inline void addReference()
+        {
+            _references.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        inline void releaseReference()
+        {
+            if (_references.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+            if (_destroyResult != nullptr)
+            {
+                _destroyResult(this);
+                _destroyResult = nullptr;
+            }
+            _resultException = nullptr;
+            _targetRuntime.releaseTask(this);
+        }
+
+        //Returns false if the task has already finished and will not notify the successor
+        inline bool addSuccessor(Task* task, uint32_t anyIndex = noAnyIndex)
+        {
+            lock_guard guard(_notifyMtx);
+            if (_taskHasFinished.load(std::memory_order_relaxed)) return false;
+            task->addReference();
+            _taskNotify.push_back({ task, anyIndex });
+            return true;
+        }
+
+        inline bool claimAny(uint32_t index)
+        {
+            uint32_t expected = noAnyIndex;
+            return _anyWinner.compare_exchange_strong(expected, index);
+        }
+
+        //Returns the next task to be run by this thread, a continuation that has been released by this task
+        inline Task* operator()()
+        {
+
+            const auto finalizeTask = [&] {
+                group_state& state = *_groupState; //the task may be reused as soon as it is released
+                _fun = nullptr;
+                _fin = nullptr;
+                Task* next = onFinish();
+                releaseReference();
+                _targetRuntime.decreaseRunningTasks(state);
+                return next;
+            };
+
+            //Tasks of a cancelled group that have not started are dropped, but their dependences are released
+            if (!_isAwaitingForFinalization && !_ignoresCancellation && _groupState->_cancelled.load(std::memory_order_relaxed))
+            {
+                if (_hasResult) _resultException = std::make_exception_ptr(std::runtime_error("MiniRun: task cancelled"));
+                return finalizeTask();
+            }
+
+            Task* previousTask = _current_task;
+            group_state* previousInline = _inlineGroup;
+            const MiniRun* previousFinal = _finalRuntime;
+            const scratch_position scratchMark = _scratch.position;
+            _current_task = this;
+            _inlineGroup = nullptr;
+            _finalRuntime = _final ? &_targetRuntime : nullptr;
+            task_activity activity(*this);
+            perf_activity counters(*this);
+
+            if (!_hasAsynchronousFinalization)
+            {
+                if (_site == nullptr) runGuarded(_fun);
+                else
+                {
+                    const int64_t start = steadyNanoseconds();
+                    runGuarded(_fun);
+                    _site->record(steadyNanoseconds() - start, _targetRuntime._autoInlineNanos.load(std::memory_order_relaxed));
+                }
+                _current_task = previousTask;
+                _inlineGroup = previousInline;
+                _finalRuntime = previousFinal;
+                _scratch.position = scratchMark;
+                return finalizeTask();
+            }
+            else
+            {
+                bool failed = false, finished = false;
+                if (!_isAwaitingForFinalization)
+                {
+                    _isAwaitingForFinalization = true;
+
+                    failed = !runGuarded(_fun);
+                }
+
+                if (!failed) failed = !runGuarded([&] { finished = _fin(); });
+                _current_task = previousTask;
+                _inlineGroup = previousInline;
+                _finalRuntime = previousFinal;
+                _scratch.position = scratchMark;
+
+                if (finished || failed) return finalizeTask();
+                _targetRuntime.addTask(this);
+                return nullptr;
+            }
+
+        }
+
+        inline void setGroup(group_t group)
+        {
+            _group = group;
+        }
+        inline group_t getGroup() const
+        {
+            return _group;
+        }
+        //The accesses are linked by the sentinels, so they must be reserved before the first one is added.
+        //Each access holds a reference to the task until it leaves the chain of its address.
+        inline void reserveAccesses(size_t count)
+        {
+            _accesses.reserve(count);
+            _references.fetch_add((int)count, std::memory_order_relaxed);
+            increaseCountdown((num_tasks_t)count);
+        }
+
+        //For an access that was reserved but is already satisfied by an enclosing task
+        inline void dropAccess()
+        {
+            _references.fetch_sub(1, std::memory_order_relaxed);
+            _countdownToRelease.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        //True if the task or the ones enclosing it hold an access to the sentinel that covers this one
+        inline bool holdsAccess(const sentinel_access_type_counter& sentinel, bool read)
+        {
+            for (Task* task = this; task != nullptr; task = task->_enclosing)
+                for (const dependency_access& access : task->_accesses)
+                    if (access.sentinel == &sentinel)
+                    {
+                        assert((read || !access.read) && "MiniRun: a task run in place can not write what its enclosing task only reads");
+                        return true;
+                    }
+            return false;
+        }
+
+        inline dependency_access* addAccess(sentinel_access_type_counter& sentinel, bool read)
+        {
+            dependency_access& access = _accesses.push();
+            access.reset(this, &sentinel, read);
+            return &access;
+        }
+
+        inline void increaseCountdown(num_tasks_t count = 1)
+        {
+            _countdownToRelease.fetch_add(count, std::memory_order_relaxed);
+        }
+
+        //Returns true when the task becomes ready, without scheduling it
+        inline bool releaseCountdown()
+        {
+            return _countdownToRelease.fetch_sub(1, std::memory_order_acq_rel) == 1;
+        }
+
+        inline void decreaseCountdown()
+        {
+            if (releaseCountdown()) _targetRuntime.addTask(this);
+        }
+
+        inline Task* onFinish()
+        {
+            {
+                lock_guard guard(_notifyMtx);
+                _taskHasFinished.store(true, std::memory_order_release);
+            }
+            for (dependency_access& access : _accesses) access.update(dependency_access::complete);
+
+            //The first released continuation runs in this thread, where its input is still in cache, if it can run here
+            Task* next = nullptr;
+            for (const successor& notify : _taskNotify)
+            {
+                if ((notify.anyIndex == noAnyIndex || notify.task->claimAny(notify.anyIndex)) && notify.task->releaseCountdown())
+                {
+                    if (next == nullptr && notify.task->_executor == _executor && !notify.task->_undeferred) next = notify.task;
+                    else _targetRuntime.addTask(notify.task);
+                }
+                notify.task->releaseReference();
+            }
+            _taskNotify.clear();
+            return next;
+        }
+    };
+
+    //Records the task in the thread record while it runs, the tasks run inside a taskwait are nested
+    class task_activity
+    {
+        thread_record* _record = nullptr;
+        const MiniRun* _runtime = nullptr;
+        const char*    _label = nullptr;
+        group_t        _group = 0;
+        int64_t        _since = 0;
+    public:
+        inline task_activity(const Task& task)
+        {
+            if (!dumpEnabled()) return;
+            _record = &currentThreadRecord();
+            _runtime = _record->runtime.exchange(&task._targetRuntime, std::memory_order_relaxed);
+            _label = _record->label.exchange(task._label, std::memory_order_relaxed);
+            _group = _record->group.exchange(task._group, std::memory_order_relaxed);
+            _since = _record->since.exchange(steadyNanoseconds(), std::memory_order_relaxed);
+        }
+        inline ~task_activity()
+        {
+            if (_record == nullptr) return;
+            _record->runtime.store(_runtime, std::memory_order_relaxed);
+            _record->label.store(_label, std::memory_order_relaxed);
+            _record->group.store(_group, std::memory_order_relaxed);
+            _record->since.store(_since, std::memory_order_relaxed);
+        }
+    };
+
+    //Cycles, instructions, last level cache misses and context switches
+    static constexpr size_t perfEvents = 4;
+    static inline std::atomic<bool> _perfEnabled{ false };
+
+    //Time and counters of the tasks of a label in a thread
+    struct perf_totals
+    {
+        uint64_t tasks;
+        uint64_t nanoseconds;
+        uint64_t counters[perfEvents];
+    };
+
+    //Values at the start of a running task, kept out of the stack of the nested taskwaits
+    struct perf_start
+    {
+        const char* label;
+        int64_t     nanoseconds;
+        uint64_t    counters[perfEvents];
+    };
+
+    //Counter group of a thread that runs tasks, opened by the thread itself. The events the kernel refuses are left out,
+    //without any of them only the times are recorded. The context switches come from getrusage without their event.
+    struct perf_thread
+    {
+        SpinLock                                     lock;
+        std::thread::id                              id;
+        const char*                                  kind;
+        int                                          fds[perfEvents];
+        int                                          leader;
+        bool                                         counted[perfEvents]; //set before the thread is registered, never changes
+        std::unordered_map<const char*, perf_totals> labels; //by task label, nullptr for the unlabelled tasks
+        std::vector<perf_start>                      running;
+
+        perf_thread() : id(std::this_thread::get_id()), kind(currentThreadRecord().kind.load(std::memory_order_relaxed)), leader(-1)
+        {
+            for (int& fd : fds) fd = -1;
+            #if defined(MINIRUN_PERF_COUNTERS)
+            static const uint32_t types[perfEvents] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE };
+            static const uint64_t configs[perfEvents] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_SW_CONTEXT_SWITCHES };
+            for (size_t i = 0; i < perfEvents; ++i)
+            {
+                perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = types[i];
+                attr.config = configs[i];
+                attr.read_format = PERF_FORMAT_GROUP;
+                attr.exclude_kernel = types[i] == PERF_TYPE_HARDWARE; //the switches happen in the kernel
+                attr.exclude_hv = 1;
+                fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+                if (leader < 0) leader = fds[i];
+            }
+            #endif
+            for (size_t i = 0; i < perfEvents; ++i) counted[i] = fds[i] >= 0;
+            #if defined(MINIRUN_PERF_COUNTERS)
+            counted[3] = true; //from getrusage without its event
+            #endif
+            std::lock_guard<std::mutex> guard(introspection().mtx);
+            introspection().perfThreads.push_back(this);
+        }
+
+        inline bool hardware() const
+        {
+            return fds[0] >= 0 || fds[1] >= 0 || fds[2] >= 0;
+        }
+
+        //The group is read with a single syscall, the values come in the order the events were opened
+        inline void sample(uint64_t (&values)[perfEvents]) const
+        {
+            uint64_t group[1 + perfEvents] = {};
+            #if defined(MINIRUN_PERF_COUNTERS)
+            if (leader >= 0 && ::read(leader, group, sizeof(group)) <= 0) memset(group, 0, sizeof(group));
+            #endif
+            size_t next = 1;
+            for (size_t i = 0; i < perfEvents; ++i) values[i] = fds[i] >= 0 ? group[next++] : 0;
+            #if defined(MINIRUN_PERF_COUNTERS)
+            rusage usage;
+            if (fds[3] < 0 && getrusage(RUSAGE_THREAD, &usage) == 0) values[3] = (uint64_t)(usage.ru_nvcsw + usage.ru_nivcsw);
+            #endif
+        }
+
+        //Out of line, Task::operator() is in the stack once per nested taskwait
+        MINIRUN_NOINLINE void begin(const char* label)
+        {
+            perf_start& start = running.emplace_back();
+            start.label = label;
+            sample(start.counters);
+            start.nanoseconds = steadyNanoseconds();
+        }
+
+        MINIRUN_NOINLINE void end()
+        {
+            const int64_t now = steadyNanoseconds();
+            uint64_t counters[perfEvents];
+            sample(counters);
+            const perf_start& start = running.back();
+            {
+                lock_guard guard(lock);
+                perf_totals& totals = labels[start.label];
+                ++totals.tasks;
+                totals.nanoseconds += (uint64_t)(now - start.nanoseconds);
+                for (size_t i = 0; i < perfEvents; ++i) totals.counters[i] += counters[i] - start.counters[i];
+            }
+            running.pop_back();
+        }
+
+        inline void close()
+        {
+            lock_guard guard(lock);
+            #if defined(MINIRUN_PERF_COUNTERS)
+            for (int& fd : fds) if (fd >= 0) ::close(fd);
+            #endif
+            for (int& fd : fds) fd = -1;
+            leader = -1;
+        }
+    };
+
+    struct perf_thread_owner
+    {
+        perf_thread* thread;
+        perf_thread_owner() : thread(new perf_thread()) {}
+        ~perf_thread_owner() { thread->close(); }
+    };
+
+    static inline perf_thread& currentPerfThread()
+    {
+        static thread_local perf_thread_owner owner;
+        return *owner.thread;
+    }
+
+    //Adds the time and the counters of the task to its label in this thread, including the tasks nested in its taskwaits
+    class perf_activity
+    {
+        perf_thread* _thread = nullptr;
+    public:
+        inline perf_activity(const Task& task)
+        {
+            if (!_perfEnabled.load(std::memory_order_relaxed)) return;
+            _thread = &currentPerfThread();
+            _thread->begin(task._label);
+        }
+        inline ~perf_activity()
+        {
+            if (_thread != nullptr) _thread->end();
+        }
+    };
+
+public:
+
+    //Handle to the result of a value returning task, the result lives in the task record until the last handle is destroyed
+    template<typename T>
+    class Future
+    {
+        friend class MiniRun;
+        Task* _task = nullptr;
+
+        //A task with a future always has a result, a cancelled one stores an exception in it
+        explicit Future(Task* task) : _task(task) { _task->addReference(); _task->_hasResult = true; }
+
+        template<typename F, bool = std::is_void<T>::value> struct continuation { using type = typename std::invoke_result<F&, T&>::type; };
+        template<typename F> struct continuation<F, true> { using type = typename std::invoke_result<F&>::type; };
+
+    public:
+        Future() = default;
+        Future(const Future& other) : _task(other._task) { if (_task != nullptr) _task->addReference(); }
+        Future(Future&& other) noexcept : _task(other._task) { other._task = nullptr; }
+        Future& operator=(Future other) noexcept { std::swap(_task, other._task); return *this; }
+        ~Future() { if (_task != nullptr) _task->releaseReference(); }
+
+        inline bool valid() const { return _task != nullptr; }
+
+        //The future must be valid: ready, wait, get and then need the task of a future returned by the runtime
+        inline bool ready() const
+        {
+            assert(valid() && "MiniRun: the future has no task");
+            return _task->_taskHasFinished.load(std::memory_order_acquire);
+        }
+
+        //While waiting, the thread is used for executing tasks
+        inline void wait() const
+        {
+            while (!ready()) _task->_targetRuntime.runTaskExternalThread();
+        }
+
+        //Rethrows the exception of the task, if any
+        inline typename std::add_lvalue_reference<T>::type get() const
+        {
+            wait();
+            if (_task->_resultException) std::rethrow_exception(_task->_resultException);
+            if constexpr (!std::is_void<T>::value) return _task->template result<T>();
+        }
+
+        //The continuation is registered as a dependent of this task in the same group, and runs in the thread that finishes it
+        template<typename F>
+        inline Future<typename continuation<F>::type> then(F&& fun) const
+        {
+            using R = typename continuation<F>::type;
+            assert(valid() && "MiniRun: the future has no task");
+            Task* predecessor = _task;
+            return _task->_targetRuntime.template createContinuation<R>(&predecessor, 1, false, _task->_group,
+                [input = *this, fun = std::forward<F>(fun)](Task*) mutable -> R
+                {
+                    if constexpr (std::is_void<T>::value)
+                    {
+                        input.get();
+                        return fun();
+                    }
+                    else return fun(input.get());
+                });
+        }
+    };
+
+#if defined(MINIRUN_COROUTINES)
+    //Coroutine task, suspends on co_await of async_taskwait or deps_ready without blocking the thread, and is resumed by a task in any worker
+    class Coroutine
+    {
+        friend class MiniRun;
+
+        //Coroutine frames are recycled in per thread free lists of size classes
+        class FramePool
+        {
+            static constexpr size_t granularity = 64;
+            static constexpr size_t sizeClasses = 32;
+            static constexpr size_t maxCachedFrames = 256;
+
+            struct frame { frame* next; };
+            struct cache
+            {
+                frame* heads[sizeClasses] = {};
+                size_t counts[sizeClasses] = {};
+                ~cache()
+                {
+                    for (frame* head : heads)
+                        while (head != nullptr) { frame* next = head->next; ::operator delete(head); head = next; }
+                }
+            };
+
+            static inline cache& localCache()
+            {
+                static thread_local cache frames;
+                return frames;
+            }
+
+        public:
+            static inline void* allocate(size_t size)
+            {
+                const size_t sizeClass = (size + granularity - 1) / granularity;
+                if (sizeClass >= sizeClasses) return ::operator new(size);
+
+                cache& frames = localCache();
+                if (frame* head = frames.heads[sizeClass])
+                {
+                    frames.heads[sizeClass] = head->next;
+                    frames.counts[sizeClass]--;
+                    return head;
+                }
+                return ::operator new(sizeClass * granularity);
+            }
+
+            static inline void deallocate(void* ptr, size_t size)
+            {
+                const size_t sizeClass = (size + granularity - 1) / granularity;
+                cache& frames = localCache();
+                if (sizeClass >= sizeClasses || frames.counts[sizeClass] >= maxCachedFrames) return ::operator delete(ptr);
+
+                frame* head = static_cast<frame*>(ptr);
+                head->next = frames.heads[sizeClass];
+                frames.heads[sizeClass] = head;
+                frames.counts[sizeClass]++;
+            }
+        };
+
+    public:
+        struct promise_type
+        {
+            MiniRun*     _runtime = nullptr;
+            group_t      _group = defaultGroup;
+            group_state* _state = nullptr;
+
+            struct final_awaiter
+            {
+                inline bool await_ready() noexcept { return false; }
+                inline void await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                {
+                    MiniRun& runtime = *handle.promise()._runtime;
+                    group_state& state = *handle.promise()._state;
+                    handle.destroy();
+                    runtime.decreaseRunningTasks(state);
+                }
+                inline void await_resume() noexcept {}
+            };
+
+            inline Coroutine get_return_object() { return Coroutine(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            inline std::suspend_always initial_suspend() noexcept { return {}; }
+            inline final_awaiter final_suspend() noexcept { return {}; }
+            inline void return_void() {}
+            inline void unhandled_exception() { _state->captureException(std::current_exception()); }
+
+            static inline void* operator new(size_t size) { return FramePool::allocate(size); }
+            static inline void operator delete(void* ptr, size_t size) { FramePool::deallocate(ptr, size); }
+        };
+
+        Coroutine(Coroutine&& other) noexcept : _handle(other._handle) { other._handle = nullptr; }
+        Coroutine(const Coroutine&) = delete;
+        Coroutine& operator=(const Coroutine&) = delete;
+        ~Coroutine() { if (_handle) _handle.destroy(); }
+
+    private:
+        explicit Coroutine(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+        std::coroutine_handle<promise_type> _handle;
+    };
+
+    struct taskwait_awaiter
+    {
+        MiniRun&     _runtime;
+        group_state& _state;
+
+        inline bool await_ready() const { return _state._running == 0; }
+
+        //The resumption task is held by the group until it has no running tasks
+        inline void await_suspend(std::coroutine_handle<Coroutine::promise_type> handle)
+        {
+            Task* task = _runtime.createResumeTask(handle, deps(), deps());
+            if (!_state.addWaiter(task)) task->decreaseCountdown();
+        }
+
+        inline void await_resume()
+        {
+            _state.restoreRenamed();
+            _state._cancelled = false;
+            if (std::exception_ptr exception = _state.takeException()) std::rethrow_exception(exception);
+        }
+    };
+
+    struct deps_awaiter
+    {
+        MiniRun&   _runtime;
+        dep_list_t _in, _out;
+
+        inline bool await_ready() const { return false; }
+
+        //The coroutine holds the dependences until its next suspension
+        inline void await_suspend(std::coroutine_handle<Coroutine::promise_type> handle)
+        {
+            _runtime.createResumeTask(handle, _in, _out)->decreaseCountdown();
+        }
+
+        inline void await_resume() {}
+    };
+#endif
+
+    //Dedicated threads for the tasks bound to a thread context (a GPU, a GL context, a single threaded library).
+    //The setup runs once in each thread before its first task, so the context is made current once per thread instead of
+    //once per task. On linux the threads are pinned to the given cpus and named after the executor.
+    //The tasks of an executor keep their group and dependences, the executor must outlive them.
+    class Executor
+    {
+        std::string               _name;
+        std::function<void()>     _setup;
+        std::vector<int>          _cpus;
+        std::mutex                _mtx;
+        std::condition_variable   _condition;
+        std::queue<Task*>         _tasks;
+        std::vector<std::thread>  _threads;
+        bool                      _alive = true;
+
+        inline void configureThread()
+        {
+            #if defined(__linux__)
+            if (!_cpus.empty())
+            {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                for (int cpu : _cpus) CPU_SET(cpu, &set);
+                sched_setaffinity(0, sizeof(set), &set);
+            }
+            pthread_setname_np(pthread_self(), _name.substr(0, 15).c_str());
+            #endif
+            currentThreadRecord().kind.store(_name.c_str(), std::memory_order_relaxed);
+            if (_setup) _setup();
+        }
+
+        inline void worker()
+        {
+            configureThread();
+            std::unique_lock<std::mutex> guard(_mtx);
+            while (true)
+            {
+                _condition.wait(guard, [&] { return !_alive || !_tasks.empty(); });
+                if (_tasks.empty()) return;
+                Task* task = _tasks.front();
+                _tasks.pop();
+                guard.unlock();
+                while (task != nullptr) task = (*task)();
+                guard.lock();
+            }
+        }
+
+    public:
+        Executor(std::string name, std::function<void()> setup = nullptr, std::vector<int> cpus = {}, int numThreads = 1) :
+            _name(std::move(name)), _setup(std::move(setup)), _cpus(std::move(cpus))
+        {
+            for (int i = 0; i < std::max(numThreads, 1); ++i)
+                _threads.push_back(std::thread([this] { worker(); }));
+            std::lock_guard<std::mutex> guard(introspection().mtx);
+            introspection().executors.push_back(this);
+        }
+
+        ~Executor()
+        {
+            unregister<Executor*>(introspection().executors, this);
+            {
+                std::lock_guard<std::mutex> guard(_mtx);
+                _alive = false;
+            }
+            _condition.notify_all();
+            for (auto& thread : _threads) thread.join();
+        }
+
+        Executor(const Executor&) = delete;
+        Executor& operator=(const Executor&) = delete;
+
+        inline const std::string& name() const { return _name; }
+
+        inline size_t queuedTasks()
+        {
+            std::lock_guard<std::mutex> guard(_mtx);
+            return _tasks.size();
+        }
+
+        inline void push(Task* task)
+        {
+            {
+                std::lock_guard<std::mutex> guard(_mtx);
+                _tasks.push(task);
+            }
+            _condition.notify_one();
+        }
+    };
+
+    enum stage_kind { serial_in_order, parallel };
+
+    //Stream of items processed by a sequence of stages. At most tokens items are in flight and their buffers are reused,
+    //so the source fills a buffer that was used by a previous item. The source is serial and returns false at the end of
+    //the stream, the serial_in_order stages process the items one at a time in the order the source produced them.
+    //A thread carries an item through the stages until one of them is waiting for a previous item.
+    template<typename T>
+    class Pipeline
+    {
+        struct item
+        {
+            T      value;
+            size_t sequence;
+            bool   failed;
+        };
+
+        struct filter
+        {
+            stage_kind              kind;
+            std::function<void(T&)> fun;
+            SpinLock                mtx;
+            size_t                  next = 0; //sequence of the next item of a serial stage
+            std::vector<item*>      parked;   //items that arrived before their turn, indexed by sequence modulo tokens
+
+            filter(stage_kind kind, std::function<void(T&)> fun) : kind(kind), fun(std::move(fun)) {}
+        };
+
+        MiniRun&                             _runtime;
+        group_t                              _group;
+        group_state&                         _state;
+        std::vector<item>                    _items;
+        SpinLock                             _freeMtx;
+        std::vector<item*>                   _free;
+        std::function<bool(T&)>              _source;
+        std::vector<std::unique_ptr<filter>> _stages;
+        size_t                               _nextSequence = 0; //only used by the thread running the source
+        std::atomic<bool>                    _producing{ false };
+        std::atomic<bool>                    _ended{ false };
+        std::atomic<size_t>                  _inFlight{ 0 };
+        std::atomic<size_t>                  _activeTasks{ 0 };
+        std::atomic<size_t>                  _waitingTasks{ 0 };  //spawned tasks that have not started yet
+        SpinLock                             _exceptionMtx;
+        std::exception_ptr                   _exception;
+
+        inline bool hasFreeTokens() const { return _inFlight.load() < _items.size(); }
+
+        inline void fail()
+        {
+            lock_guard guard(_exceptionMtx);
+            if (!_exception) _exception = std::current_exception();
+            _ended = true;
+        }
+
+        //Only one thread runs the source, the others give up. The owner tries again if a token was freed meanwhile.
+        inline item* produce()
+        {
+            while (!_ended.load() && hasFreeTokens())
+            {
+                bool expected = false;
+                if (!_producing.compare_exchange_strong(expected, true)) return nullptr;
+
+                item* produced = nullptr;
+                if (_state._cancelled.load(std::memory_order_relaxed)) _ended = true;
+                else if (!_ended.load() && hasFreeTokens())
+                {
+                    {
+                        lock_guard guard(_freeMtx);
+                        produced = _free.back();
+                        _free.pop_back();
+                    }
+                    _inFlight++;
+                    bool more = false;
+                    try { more = _source(produced->value); }
+                    catch (...) { fail(); }
+                    if (more)
+                    {
+                        produced->sequence = _nextSequence++;
+                        produced->failed = false;
+                    }
+                    else
+                    {
+                        _ended = true;
+                        release(produced);
+                        produced = nullptr;
+                    }
+                }
+                _producing = false;
+                if (produced != nullptr) return produced;
+            }
+            return nullptr;
+        }
+
+        inline void release(item* finished)
+        {
+            {
+                lock_guard guard(_freeMtx);
+                _free.push_back(finished);
+            }
+            _inFlight--;
+        }
+
+        inline void runStage(filter& current, item* carried)
+        {
+            if (carried->failed) return; //it still goes through the serial stages to keep the order of the next ones
+            try { current.fun(carried->value); }
+            catch (...)
+            {
+                carried->failed = true;
+                fail();
+            }
+        }
+
+        inline void carry(item* carried, size_t first)
+        {
+            for (size_t k = first; k < _stages.size(); ++k)
+            {
+                filter& current = *_stages[k];
+                if (current.kind == parallel)
+                {
+                    runStage(current, carried);
+                    continue;
+                }
+
+                {
+                    lock_guard guard(current.mtx);
+                    if (carried->sequence != current.next)
+                    {
+                        current.parked[carried->sequence % _items.size()] = carried;
+                        return;
+                    }
+                }
+                runStage(current, carried);
+
+                item* resumed;
+                {
+                    lock_guard guard(current.mtx);
+                    item*& slot = current.parked[++current.next % _items.size()];
+                    resumed = slot;
+                    slot = nullptr;
+                }
+                if (resumed != nullptr) spawn(resumed, k);
+            }
+            release(carried);
+        }
+
+        inline void work()
+        {
+            while (item* produced = produce())
+            {
+                if (!_ended.load() && hasFreeTokens() && _waitingTasks.load() == 0) spawn(nullptr, 0);
+                carry(produced, 0);
+            }
+        }
+
+        //The tasks are not dropped by a cancellation of the group, the pipeline stops producing items instead
+        inline void spawn(item* resumed, size_t stageIndex)
+        {
+            _activeTasks++;
+            if (resumed == nullptr) _waitingTasks++;
+            Task* task = _runtime.getPreallocatedTask()->prepare([this, resumed, stageIndex] {
+                if (resumed != nullptr) carry(resumed, stageIndex);
+                else _waitingTasks--;
+                work();
+                _activeTasks--;
+            }, _group);
+            task->_ignoresCancellation = true;
+            _runtime.registerTask(task, deps(), deps());
+        }
+
+    public:
+        Pipeline(MiniRun& runtime, size_t tokens, group_t group) : _runtime(runtime), _group(group), _state(runtime.getGroupState(group)), _items(std::max<size_t>(tokens, 1))
+        {
+            for (item& token : _items) _free.push_back(&token);
+        }
+        Pipeline(const Pipeline&) = delete;
+        Pipeline& operator=(const Pipeline&) = delete;
+
+        inline Pipeline& source(std::function<bool(T&)> fun)
+        {
+            _source = std::move(fun);
+            return *this;
+        }
+
+        inline Pipeline& stage(stage_kind kind, std::function<void(T&)> fun)
+        {
+            _stages.emplace_back(new filter(kind, std::move(fun)));
+            _stages.back()->parked.resize(_items.size(), nullptr);
+            return *this;
+        }
+
+        //The calling thread takes part in the pipeline and runs tasks until the stream has been processed,
+        //then it rethrows the first exception thrown by a stage
+        inline void run()
+        {
+            _ended = false;
+            _nextSequence = 0;
+            for (auto& current : _stages) current->next = 0;
+
+            work();
+            while (!_ended.load() || _inFlight.load() != 0 || _activeTasks.load() != 0)
+            {
+                work();
+                _runtime.runTaskExternalThread();
+            }
+
+            std::exception_ptr exception = _exception;
+            _exception = nullptr;
+            if (exception) std::rethrow_exception(exception);
+        }
+    };
+
+    //A tile of a TileMatrix, in deps it stands for the whole tile
+    template<typename T>
+    struct tile_view
+    {
+        T*  data;
+        int rows;
+        int cols;
+        int ld;
+
+        inline dep_t dep_key() const { return (dep_t)data; }
+        inline operator T*() const { return data; }
+        inline T& operator()(int i, int j) const { return data[(size_t)j * ld + i]; }
+    };
+
+    //Matrix stored by square tiles of ts x ts elements. Each tile is contiguous, column major and starts in its own cache line,
+    //the tiles of the border are padded with zeros. The tiles are first touched by tasks of the runtime, so on NUMA machines
+    //their pages are placed near the threads that use them. The conversions are tasks with dependences on the tiles,
+    //so the matrix must outlive its tasks.
+    template<typename T>
+    class TileMatrix
+    {
+        MiniRun& _runtime;
+        int      _rows;
+        int      _cols;
+        int      _ts;
+        int      _rowTiles;
+        int      _colTiles;
+        size_t   _tileStride; //elements from the start of a tile to the next one
+        T*       _data;
+        group_t  _group;      //of every tile task, the dependences are tracked by group
+
+        static constexpr size_t pageSize = 4096;
+
+        inline int tileRows(int i) const { return std::min(_ts, _rows - i * _ts); }
+        inline int tileCols(int j) const { return std::min(_ts, _cols - j * _ts); }
+
+    public:
+        TileMatrix(MiniRun& runtime, int rows, int cols, int ts, group_t group = defaultGroup) :
+            _runtime(runtime), _rows(rows), _cols(cols), _ts(ts), _rowTiles((rows + ts - 1) / ts), _colTiles((cols + ts - 1) / ts), _group(group)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "TileMatrix elements are copied with memcpy");
+            const size_t tileBytes = ((size_t)ts * ts * sizeof(T) + cacheLineSize - 1) / cacheLineSize * cacheLineSize;
+            _tileStride = tileBytes / sizeof(T);
+            _data = (T*)::operator new(tileBytes * _rowTiles * _colTiles, std::align_val_t(pageSize));
+
+            for (int j = 0; j < _colTiles; ++j)
+                for (int i = 0; i < _rowTiles; ++i)
+                    _runtime.createTask([tile = tile(i, j), bytes = tileBytes] { memset((void*)tile.data, 0, bytes); }, deps(), deps(tile(i, j)), _group);
+        }
+
+        ~TileMatrix() { ::operator delete((void*)_data, std::align_val_t(pageSize)); }
+
+        TileMatrix(const TileMatrix&) = delete;
+        TileMatrix& operator=(const TileMatrix&) = delete;
+
+        inline int rows() const { return _rows; }
+        inline int cols() const { return _cols; }
+        inline int tileSize() const { return _ts; }
+        inline int rowTiles() const { return _rowTiles; }
+        inline int colTiles() const { return _colTiles; }
+        //The tasks that use the tiles as dependences must be created in this group to be ordered with the tile tasks
+        inline group_t group() const { return _group; }
+
+        inline tile_view<T> tile(int i, int j) const
+        {
+            return { _data + ((size_t)j * _rowTiles + i) * _tileStride, tileRows(i), tileCols(j), _ts };
+        }
+
+        inline tile_view<T> operator()(int i, int j) const { return tile(i, j); }
+
+        //Copies a column major matrix into the tiles with a task per tile, A must not change until they finish
+        inline void fromColumnMajor(const T* A, size_t lda)
+        {
+            for (int j = 0; j < _colTiles; ++j)
+                for (int i = 0; i < _rowTiles; ++i)
+                {
+                    const T* source = A + (size_t)j * _ts * lda + (size_t)i * _ts;
+                    _runtime.createTask([tile = tile(i, j), source, lda] {
+                        for (int c = 0; c < tile.cols; ++c)
+                            memcpy(tile.data + (size_t)c * tile.ld, source + c * lda, tile.rows * sizeof(T));
+                    }, deps(), deps(tile(i, j)), _group);
+                }
+        }
+
+        //Copies the tiles into a column major matrix with a task per tile, the tasks wait for the previous writers of the tiles
+        inline void toColumnMajor(T* A, size_t lda) const
+        {
+            for (int j = 0; j < _colTiles; ++j)
+                for (int i = 0; i < _rowTiles; ++i)
+                {
+                    T* target = A + (size_t)j * _ts * lda + (size_t)i * _ts;
+                    _runtime.createTask([tile = tile(i, j), target, lda] {
+                        for (int c = 0; c < tile.cols; ++c)
+                            memcpy(target + c * lda, tile.data + (size_t)c * tile.ld, tile.rows * sizeof(T));
+                    }, deps(tile(i, j)), deps(), _group);
+                }
+        }
+    };
+
+    //SENDERS
+    //Senders and receivers in the shape of P2300 (std::execution) on top of the tasks. A sender describes work and the
+    //values it completes with (as a tuple type), connect binds it to a receiver (set_value, set_error, set_stopped) in an
+    //operation state that holds the states of its predecessors inline, and start launches it. The operation state must
+    //stay alive and in place until the receiver is completed.
+    template<typename S, typename = void> struct isSender : std::false_type {};
+    template<typename S> struct isSender<S, std::void_t<typename std::decay<S>::type::values, decltype(std::declval<const S&>().get_scheduler())>> : std::true_type {};
+
+    //Starts the work in a task of its runtime and group. A cancelled group completes the receiver with set_stopped.
+    class scheduler
+    {
+        friend class MiniRun;
+        MiniRun* _runtime;
+        group_t  _group;
+        scheduler(MiniRun* runtime, group_t group) : _runtime(runtime), _group(group) {}
+
+    public:
+        class sender
+        {
+            friend class scheduler;
+            MiniRun* _runtime;
+            group_t  _group;
+            sender(MiniRun* runtime, group_t group) : _runtime(runtime), _group(group) {}
+
+        public:
+            using values = std::tuple<>;
+
+            template<typename R>
+            class operation
+            {
+                MiniRun* _runtime;
+                group_t  _group;
+                R        _receiver;
+
+            public:
+                operation(MiniRun* runtime, group_t group, R&& receiver) : _runtime(runtime), _group(group), _receiver(std::move(receiver)) {}
+                operation(const operation&) = delete;
+
+                inline void start() noexcept
+                {
+                    _runtime->createSenderTask([this] {
+                        if (isCancelled()) return _receiver.set_stopped();
+                        try { _receiver.set_value(); }
+                        catch (...) { _receiver.set_error(std::current_exception()); }
+                    }, _group);
+                }
+            };
+
+            template<typename R>
+            inline operation<R> connect(R receiver) && { return operation<R>(_runtime, _group, std::move(receiver)); }
+            inline scheduler get_scheduler() const { return scheduler(_runtime, _group); }
+        };
+
+        inline sender schedule() const { return sender(_runtime, _group); }
+        inline MiniRun& runtime() const { return *_runtime; }
+        inline group_t group() const { return _group; }
+        friend inline bool operator==(const scheduler& a, const scheduler& b) { return a._runtime == b._runtime && a._group == b._group; }
+        friend inline bool operator!=(const scheduler& a, const scheduler& b) { return !(a == b); }
+    };
+
+    //Calls the function with the values in the thread that completes the predecessor, no task is created for it
+    template<typename S, typename F>
+    class then_sender
+    {
+        friend class MiniRun;
+        S _sender;
+        F _fun;
+        then_sender(S&& sender, F&& fun) : _sender(std::move(sender)), _fun(std::move(fun)) {}
+
+        template<typename Values> struct result;
+        template<typename... V> struct result<std::tuple<V...>> { using type = typename std::invoke_result<F&, V...>::type; };
+        using result_t = typename result<typename S::values>::type;
+
+        template<typename R>
+        struct receiver
+        {
+            F _fun;
+            R _next;
+
+            template<typename... V>
+            inline void set_value(V&&... values)
+            {
+                try
+                {
+                    if constexpr (std::is_void<result_t>::value)
+                    {
+                        std::invoke(_fun, std::forward<V>(values)...);
+                        _next.set_value();
+                    }
+                    else _next.set_value(std::invoke(_fun, std::forward<V>(values)...));
+                }
+                catch (...) { _next.set_error(std::current_exception()); }
+            }
+            inline void set_error(std::exception_ptr error) { _next.set_error(error); }
+            inline void set_stopped() { _next.set_stopped(); }
+        };
+
+    public:
+        using values = typename std::conditional<std::is_void<result_t>::value, std::tuple<>, std::tuple<result_t>>::type;
+
+        template<typename R>
+        inline auto connect(R next) && { return std::move(_sender).connect(receiver<R>{ std::move(_fun), std::move(next) }); }
+        inline scheduler get_scheduler() const { return _sender.get_scheduler(); }
+    };
+
+    //Calls the function with each index of [0, count) and the values, in tasks of contiguous ranges of indexes, a few per
+    //thread of the pool. It completes with the same values once all of them have finished.
+    template<typename S, typename F>
+    class bulk_sender
+    {
+        friend class MiniRun;
+        S      _sender;
+        size_t _count;
+        F      _fun;
+        bulk_sender(S&& sender, size_t count, F&& fun) : _sender(std::move(sender)), _count(count), _fun(std::move(fun)) {}
+
+    public:
+        using values = typename S::values;
+
+        template<typename R>
+        class operation
+        {
+            struct receiver
+            {
+                operation* _operation;
+
+                template<typename... V>
+                inline void set_value(V&&... values) { _operation->run(std::forward<V>(values)...); }
+                inline void set_error(std::exception_ptr error) { _operation->_next.set_error(error); }
+                inline void set_stopped() { _operation->_next.set_stopped(); }
+            };
+
+            F                     _fun;
+            size_t                _count;
+            R                     _next;
+            scheduler             _scheduler;
+            std::optional<values> _values;
+            size_t                _chunks = 0;
+            std::atomic<size_t>   _pending{ 0 };
+            std::atomic<bool>     _failed{ false };
+            std::atomic<bool>     _stopped{ false };
+            std::exception_ptr    _error;
+            decltype(std::declval<S>().connect(std::declval<receiver>())) _predecessor;
+
+            template<typename... V>
+            inline void run(V&&... values)
+            {
+                _values.emplace(std::forward<V>(values)...);
+                MiniRun& runtime = _scheduler.runtime();
+                _chunks = std::min<size_t>(_count, 4 * ((size_t)runtime.numThreads() + 1));
+                if (_chunks == 0) return complete();
+                _pending.store(_chunks, std::memory_order_relaxed);
+                for (size_t chunk = 0; chunk < _chunks; ++chunk)
+                    runtime.createSenderTask([this, chunk] { runChunk(chunk); }, _scheduler.group());
+            }
+
+            inline void runChunk(size_t chunk)
+            {
+                if (isCancelled()) _stopped.store(true, std::memory_order_relaxed);
+                else if (!_failed.load(std::memory_order_relaxed))
+                {
+                    try
+                    {
+                        const size_t last = _count * (chunk + 1) / _chunks;
+                        for (size_t i = _count * chunk / _chunks; i < last; ++i)
+                            std::apply([&](auto&... values) { std::invoke(_fun, i, values...); }, *_values);
+                    }
+                    catch (...)
+                    {
+                        if (!_failed.exchange(true)) _error = std::current_exception();
+                    }
+                }
+                if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) complete();
+            }
+
+            inline void complete()
+            {
+                if (_failed.load(std::memory_order_relaxed)) _next.set_error(_error);
+                else if (_stopped.load(std::memory_order_relaxed)) _next.set_stopped();
+                else std::apply([&](auto&... values) { _next.set_value(std::move(values)...); }, *_values);
+            }
+
+        public:
+            operation(S&& sender, size_t count, F&& fun, R&& next) : _fun(std::move(fun)), _count(count), _next(std::move(next)),
+                _scheduler(sender.get_scheduler()), _predecessor(std::move(sender).connect(receiver{ this })) {}
+            operation(const operation&) = delete;
+
+            inline void start() noexcept { _predecessor.start(); }
+        };
+
+        template<typename R>
+        inline operation<R> connect(R next) && { return operation<R>(std::move(_sender), _count, std::move(_fun), std::move(next)); }
+        inline scheduler get_scheduler() const { return _sender.get_scheduler(); }
+    };
+
+    //Starts all the senders and completes with their values concatenated once all of them have completed, with the first
+    //error, or stopped if one of them was stopped
+    template<typename... S>
+    class when_all_sender
+    {
+        friend class MiniRun;
+        std::tuple<S...> _senders;
+        when_all_sender(S&&... senders) : _senders(std::move(senders)...) {}
+
+    public:
+        using values = decltype(std::tuple_cat(std::declval<typename S::values>()...));
+
+        template<typename R>
+        class operation
+        {
+            template<size_t I>
+            struct receiver
+            {
+                operation* _operation;
+
+                template<typename... V>
+                inline void set_value(V&&... values)
+                {
+                    std::get<I>(_operation->_values).emplace(std::forward<V>(values)...);
+                    _operation->arrive();
+                }
+                inline void set_error(std::exception_ptr error)
+                {
+                    if (!_operation->_failed.exchange(true)) _operation->_error = error;
+                    _operation->arrive();
+                }
+                inline void set_stopped()
+                {
+                    _operation->_stopped.store(true, std::memory_order_relaxed);
+                    _operation->arrive();
+                }
+            };
+
+            //The states of the senders, built in place
+            template<size_t I, typename... Rest>
+            struct children
+            {
+                children(operation*, std::tuple<S...>&) {}
+                inline void start() noexcept {}
+            };
+
+            template<size_t I, typename First, typename... Rest>
+            struct children<I, First, Rest...>
+            {
+                decltype(std::declval<First>().connect(std::declval<receiver<I>>())) _state;
+                children<I + 1, Rest...> _rest;
+
+                children(operation* owner, std::tuple<S...>& senders) : _state(std::move(std::get<I>(senders)).connect(receiver<I>{ owner })), _rest(owner, senders) {}
+                inline void start() noexcept
+                {
+                    _state.start();
+                    _rest.start();
+                }
+            };
+
+            R                                                    _next;
+            std::tuple<std::optional<typename S::values>...>     _values;
+            std::atomic<size_t>                                  _pending{ sizeof...(S) };
+            std::atomic<bool>                                    _failed{ false };
+            std::atomic<bool>                                    _stopped{ false };
+            std::exception_ptr                                   _error;
+            children<0, S...>                                    _children;
+
+            inline void arrive()
+            {
+                if (_pending.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+                if (_failed.load(std::memory_order_relaxed)) _next.set_error(_error);
+                else if (_stopped.load(std::memory_order_relaxed)) _next.set_stopped();
+                else std::apply([&](auto&&... values) { _next.set_value(std::move(values)...); },
+                    std::apply([](auto&... parts) { return std::tuple_cat(std::move(*parts)...); }, _values));
+            }
+
+        public:
+            operation(std::tuple<S...>&& senders, R&& next) : _next(std::move(next)), _children(this, senders) {}
+            operation(const operation&) = delete;
+
+            inline void start() noexcept { _children.start(); }
+        };
+
+        template<typename R>
+        inline operation<R> connect(R next) && { return operation<R>(std::move(_senders), std::move(next)); }
+        inline scheduler get_scheduler() const { return std::get<0>(_senders).get_scheduler(); }
+    };
+
+    template<typename F> struct then_closure { F _fun; };
+    template<typename F> struct bulk_closure { size_t _count; F _fun; };
+
+    //The pipe syntax of the adaptors: sender | then(f) | bulk(n, f)
+    template<typename S, typename F, typename = typename std::enable_if<isSender<S>::value>::type>
+    friend inline auto operator|(S&& sender, then_closure<F> closure) { return then(std::forward<S>(sender), std::move(closure._fun)); }
+
+    template<typename S, typename F, typename = typename std::enable_if<isSender<S>::value>::type>
+    friend inline auto operator|(S&& sender, bulk_closure<F> closure) { return bulk(std::forward<S>(sender), closure._count, std::move(closure._fun)); }
+
+    //STATIC TASK GRAPHS
+    //Edge of a StaticGraph, the node To starts once From has finished
+    template<size_t From, size_t To> struct edge {};
+
+    //Predecessor counts, successors and a topological order of a graph, computed at compile time
+    template<size_t Nodes, typename... Edges>
+    struct static_graph_layout
+    {
+        std::array<uint32_t, Nodes>            predecessors{};
+        std::array<uint32_t, Nodes + 1>        offsets{};    //the successors of node i are successors[offsets[i], offsets[i + 1])
+        std::array<uint32_t, sizeof...(Edges)> successors{};
+        std::array<uint32_t, Nodes>            order{};
+        size_t                                 ordered = 0;  //Nodes if the graph has no cycles
+        bool                                   inRange = true;
+
+        template<size_t From, size_t To>
+        static constexpr std::pair<size_t, size_t> endpoints(edge<From, To>) { return { From, To }; }
+
+        static constexpr static_graph_layout build()
+        {
+            constexpr std::pair<size_t, size_t> edges[] = { endpoints(Edges())..., { 0, 0 } };
+            static_graph_layout layout{};
+            for (size_t e = 0; e < sizeof...(Edges); ++e)
+            {
+                if (edges[e].first >= Nodes || edges[e].second >= Nodes) { layout.inRange = false; return layout; }
+                layout.predecessors[edges[e].second]++;
+                layout.offsets[edges[e].first + 1]++;
+            }
+            for (size_t i = 0; i < Nodes; ++i) layout.offsets[i + 1] += layout.offsets[i];
+
+            std::array<uint32_t, Nodes + 1> filled = layout.offsets;
+            for (size_t e = 0; e < sizeof...(Edges); ++e) layout.successors[filled[edges[e].first]++] = (uint32_t)edges[e].second;
+
+            //Kahn's algorithm, the order is used when MiniRun is disabled
+            std::array<uint32_t, Nodes> remaining = layout.predecessors;
+            for (size_t i = 0; i < Nodes; ++i)
+                if (remaining[i] == 0) layout.order[layout.ordered++] = (uint32_t)i;
+            for (size_t next = 0; next < layout.ordered; ++next)
+            {
+                const uint32_t node = layout.order[next];
+                for (uint32_t s = layout.offsets[node]; s < layout.offsets[node + 1]; ++s)
+                    if (--remaining[layout.successors[s]] == 0) layout.order[layout.ordered++] = layout.successors[s];
+            }
+            return layout;
+        }
+    };
+
+    //Task graph whose nodes and edges are known at compile time, for example
+    //  using Graph = MiniRun::StaticGraph<3, MiniRun::edge<0, 2>, MiniRun::edge<1, 2>>;
+    //  auto graph = Graph::bind(run, [&]{ ... }, [&]{ ... }, [&]{ ... });
+    //  graph.launch(); graph.wait();
+    //The nodes are released by counters set from the compile time predecessor counts, without dependences, and the
+    //finishing node runs the first successor it releases.
+    template<size_t Nodes, typename... Edges>
+    class StaticGraph
+    {
+        static_assert(Nodes > 0, "MiniRun: the graph has no nodes");
+        static constexpr static_graph_layout<Nodes, Edges...> layout = static_graph_layout<Nodes, Edges...>::build();
+        static_assert(layout.inRange, "MiniRun: an edge of the graph goes to a node that does not exist");
+        static_assert(layout.ordered == Nodes, "MiniRun: the graph has a cycle");
+        static constexpr uint32_t noNode = (uint32_t)-1;
+
+    public:
+        static constexpr size_t nodes = Nodes;
+
+        static constexpr uint32_t predecessors(size_t node) { return layout.predecessors[node]; }
+
+        //The functions of the nodes and the counters of a run. It can be launched again once it has finished, it must
+        //not be moved.
+        template<typename... F>
+        class Instance
+        {
+            static_assert(sizeof...(F) == Nodes, "MiniRun: the graph needs a function per node");
+            friend class StaticGraph;
+
+            MiniRun&                _runtime;
+            std::tuple<F...>        _funs;
+            group_t                 _group = defaultGroup;
+            group_state*            _groupState = nullptr;
+            std::atomic<uint32_t>   _counters[Nodes];
+            std::atomic<size_t>     _pending{ 0 };
+            std::atomic<bool>       _failed{ false };
+            std::exception_ptr      _error;
+
+            template<typename... G>
+            Instance(MiniRun& runtime, G&&... funs) : _runtime(runtime), _funs(std::forward<G>(funs)...) {}
+
+            template<size_t I>
+            static void call(std::tuple<F...>& funs) { std::get<I>(funs)(); }
+
+            template<size_t... I>
+            inline void run(uint32_t node, std::index_sequence<I...>)
+            {
+                static constexpr void (*calls[])(std::tuple<F...>&) = { &call<I>... };
+                try
+                {
+                    calls[node](_funs);
+                }
+                catch (...)
+                {
+                    if (!_failed.exchange(true)) _error = std::current_exception();
+                }
+            }
+
+            //The tasks run in a cancelled group too, the counters of the successors have to be released
+            inline void spawn(uint32_t node)
+            {
+                Task* task = _runtime.getPreallocatedTask()->prepare([this, node] { runFrom(node); }, _group);
+                task->_ignoresCancellation = true;
+                _runtime.launchTask(task, *_groupState);
+            }
+
+            inline void runFrom(uint32_t node)
+            {
+                while (node != noNode)
+                {
+                    run(node, std::make_index_sequence<Nodes>());
+                    uint32_t next = noNode;
+                    for (uint32_t s = layout.offsets[node]; s < layout.offsets[node + 1]; ++s)
+                    {
+                        const uint32_t successor = layout.successors[s];
+                        if (_counters[successor].fetch_sub(1, std::memory_order_acq_rel) != 1) continue;
+                        if (next == noNode) next = successor;
+                        else spawn(successor);
+                    }
+                    _pending.fetch_sub(1, std::memory_order_release);
+                    node = next;
+                }
+            }
+
+        public:
+            Instance(const Instance&) = delete;
+            Instance& operator=(const Instance&) = delete;
+            ~Instance() { while (_pending.load(std::memory_order_acquire) != 0) _runtime.runTaskExternalThread(); }
+
+            //Starts the nodes without predecessors in tasks of the group
+            inline void launch(group_t group = defaultGroup)
+            {
+                if (_runtime._minirunDisabled)
+                {
+                    for (uint32_t node : layout.order) run(node, std::make_index_sequence<Nodes>());
+                    return;
+                }
+                if (_groupState == nullptr || group != _group)
+                {
+                    _group = group;
+                    _groupState = &_runtime.getGroupState(group);
+                }
+                for (size_t i = 0; i < Nodes; ++i) _counters[i].store(layout.predecessors[i], std::memory_order_relaxed);
+                _pending.store(Nodes, std::memory_order_relaxed);
+                for (uint32_t i = 0; i < Nodes; ++i)
+                    if (layout.predecessors[i] == 0) spawn(i);
+            }
+
+            inline bool finished() const { return _pending.load(std::memory_order_acquire) == 0; }
+
+            //Runs tasks until every node has finished, rethrows the first exception thrown by a node
+            inline void wait()
+            {
+                while (_pending.load(std::memory_order_acquire) != 0) _runtime.runTaskExternalThread();
+                if (!_failed.load(std::memory_order_relaxed)) return;
+                std::exception_ptr error = _error;
+                _error = nullptr;
+                _failed = false;
+                std::rethrow_exception(error);
+            }
+        };
+
+        template<typename... F>
+        static inline Instance<typename std::decay<F>::type...> bind(MiniRun& runtime, F&&... funs)
+        {
+            return Instance<typename std::decay<F>::type...>(runtime, std::forward<F>(funs)...);
+        }
+    };
+
+private:
+
+    template<typename Values>
+    struct sync_wait_state
+    {
+        std::optional<Values> values;
+        std::exception_ptr    error;
+        bool                  stopped = false;
+        std::atomic<bool>     done{ false };
+    };
+
+    template<typename Values>
+    struct sync_wait_receiver
+    {
+        sync_wait_state<Values>* _state;
+
+        template<typename... V>
+        inline void set_value(V&&... values)
+        {
+            _state->values.emplace(std::forward<V>(values)...);
+            _state->done.store(true, std::memory_order_release);
+        }
+        inline void set_error(std::exception_ptr error)
+        {
+            _state->error = error;
+            _state->done.store(true, std::memory_order_release);
+        }
+        inline void set_stopped()
+        {
+            _state->stopped = true;
+            _state->done.store(true, std::memory_order_release);
+        }
+    };
+
+    inline void releaseTask(Task* task)
+    {
+        lock_guard guard(_preallocTasksMtx);
+        _preallocatedTasks.push(task);
+    }
+
+    //When the in flight tasks reach the limit, the creating thread runs tasks until they go down to three quarters of it.
+    //Tasks created from a task of this runtime are not throttled, they may be needed to release the ones in flight.
+    inline void throttleCreation()
+    {
+        const num_tasks_t maxInFlight = _max_in_flight_tasks.load(std::memory_order_relaxed);
+        if (maxInFlight == 0 || _global_running_tasks < maxInFlight) return;
+        if (_current_task != nullptr && &_current_task->_targetRuntime == this) return;
+
+        const num_tasks_t resumeInFlight = maxInFlight - maxInFlight / 4;
+        while (_global_running_tasks > resumeInFlight)
+            runTaskExternalThread();
+    }
+
+    inline Task* getPreallocatedTask()
+    {
+        throttleCreation();
+        lock_guard guard(_preallocTasksMtx);
+        if (_preallocatedTasks.size() == 0)
+            for (int i = 0; i < 100; ++i)
+                _preallocatedTasks.push(new Task(*this));
+
+        Task* task = _preallocatedTasks.front();
+        _preallocatedTasks.pop();
+        return task;
+    }
+
+
+
+    inline  std::pair<SpinLock, sentinel_map_type>& getSentinelPairForGroup(group_t group)
+    {
+        lock_guard guard(_sentinel_map_group_lock);
+        return _sentinel_value_map.try_emplace(group, std::piecewise_construct, std::forward_as_tuple(lock_site::sentinelMap), std::forward_as_tuple()).first->second;
+    }
+
+    inline sentinel_access_type_counter& getSentinelForGroup(dep_t sentinel, group_t group)
+    {
+        auto& map = getSentinelPairForGroup(group);
+        lock_guard guard(map.first);
+        return map.second[sentinel];
+
+    }
+
+    inline group_state& getGroupState(group_t group)
+    {
+        lock_guard guard(_running_tasks_group_lock);
+        return _groups[group];
+    }
+
+    inline void increaseRunningTasks(group_state& state)
+    {
+        _global_running_tasks++;
+        state._running++;
+    }
+
+    inline void decreaseRunningTasks(group_state& state)
+    {
+        if (--state._running == 0) state.releaseWaiters();
+        _global_running_tasks--;
+    }
+
+    //Waits for every task of every group without rethrowing, used on destruction
+    inline void waitAllTasks()
+    {
+        while (_global_running_tasks != 0)
+            runTaskExternalThread();
+    }
+
+    inline void runTaskExternalThread()
+    {
+        _pool->runTaskExternalThread(&_client);
+    }
+
+    //Runs the function of a task in this thread without a task record, its exception is stored in the group as a task would do.
+    //It is dropped if the group is cancelled, and while it runs isCancelled reports its group. It has no dependences,
+    //so it has no renamed versions either.
+    inline void runInline(task_fun_t& fun, group_t group, call_site* site = nullptr)
+    {
+        group_state& state = getGroupState(group);
+        if (state._cancelled.load(std::memory_order_relaxed)) return;
+        const int64_t start = site != nullptr ? steadyNanoseconds() : 0;
+        const scratch_position scratchMark = _scratch.position;
+        group_state* previousInline = _inlineGroup;
+        _inlineGroup = &state;
+        try
+        {
+            fun();
+        }
+        catch (...)
+        {
+            state.captureException(std::current_exception());
+        }
+        _inlineGroup = previousInline;
+        _scratch.position = scratchMark;
+        if (site != nullptr) site->record(steadyNanoseconds() - start, _autoInlineNanos.load(std::memory_order_relaxed));
+    }
+
+    //Registers the task and runs it in this thread once its dependences are satisfied, see if_clause. The accesses of
+    //the tasks this thread is running are already satisfied for it, waiting for them would never end.
+    inline void runUndeferred(Task* task, const dep_list_t& in, const dep_list_t& out)
+    {
+        task->_undeferred = true;
+        task->_enclosing = _current_task;
+        registerTask(task, in, out);
+        while (!task->_undeferredReady.load(std::memory_order_acquire)) runTaskExternalThread();
+        if (Task* next = (*task)()) addTask(next);
+    }
+
+    //Registers a task without dependences in a group whose state is already known
+    inline void launchTask(Task* task, group_state& state)
+    {
+        task->_groupState = &state;
+        increaseRunningTasks(state);
+        task->activate();
+    }
+
+    //The task runs even if its group is cancelled, a sender has to complete its receiver in any case
+    inline void createSenderTask(task_fun_t fun, group_t group)
+    {
+        if (_minirunDisabled) return fun();
+        Task* task = getPreallocatedTask()->prepare(std::move(fun), group);
+        task->_ignoresCancellation = true;
+        registerTask(task, deps(), deps());
+    }
+
+    //Open addressing by the address of the type, null when the probed slots are taken by other sites
+    inline call_site* callSite(const std::type_info& type)
+    {
+        const size_t hash = ((uintptr_t)&type >> 4) * 0x9E3779B97F4A7C15ull >> 32;
+        for (size_t probe = 0; probe < callSiteProbes; ++probe)
+        {
+            call_site& site = _callSites[(hash + probe) & (callSites - 1)];
+            const std::type_info* current = site.type.load(std::memory_order_acquire);
+            if (current == nullptr && site.type.compare_exchange_strong(current, &type, std::memory_order_acq_rel)) return &site;
+            if (current == &type) return &site;
+        }
+        return nullptr;
+    }
+
+    inline void addTask(Task* task)
+    {
+        if (task->_undeferred) return task->_undeferredReady.store(true, std::memory_order_release);
+        if (task->_executor != nullptr) task->_executor->push(task);
+        else _pool->addTask(&_client, task);
+    }
+
+#if defined(MINIRUN_COROUTINES)
+    //Registers a task that resumes the coroutine in its group, it is kept held until the returned task is released
+    inline Task* createResumeTask(std::coroutine_handle<Coroutine::promise_type> handle, const dep_list_t& in, const dep_list_t& out)
+    {
+        Task* task = getPreallocatedTask()->prepare([handle] { handle.resume(); }, handle.promise()._group);
+        task->_ignoresCancellation = true;
+        task->increaseCountdown();
+        registerTask(task, in, out);
+        return task;
+    }
+#endif
+
+    inline void registerAccesses(Task* task, const dep_list_t& in, const dep_list_t& out, renaming_table* renaming = nullptr)
+    {
+        //An address listed twice, or both in and out, takes a single access, as a write if it is in out. Two accesses of
+        //the same task to one address would wait for each other.
+        const auto listed = [](const dep_list_t& list, size_t count, dep_t address) { return std::find(list.begin(), list.begin() + count, address) != list.begin() + count; };
+        const group_t group = task->getGroup();
+        for (size_t index = 0; index < in.size(); ++index)
+        {
+            dep_t i = in[index];
+            if (listed(in, index, i) || listed(out, out.size(), i)) { task->dropAccess(); continue; }
+            if (renaming != nullptr) i = renameRead(task, *renaming, i);
+            sentinel_access_type_counter& sentinel = getSentinelForGroup(i, group);
+            if (task->_enclosing != nullptr && task->_enclosing->holdsAccess(sentinel, true)) task->dropAccess();
+            else sentinel.addTaskDep(task->addAccess(sentinel, true));
+        }
+        for (size_t index = 0; index < out.size(); ++index)
+        {
+            dep_t i = out[index];
+            if (listed(out, index, i)) { task->dropAccess(); continue; }
+            if (renaming != nullptr) i = listed(in, in.size(), i) ? renameRead(task, *renaming, i) : renameWrite(task, *renaming, i);
+            sentinel_access_type_counter& sentinel = getSentinelForGroup(i, group);
+            if (task->_enclosing != nullptr && task->_enclosing->holdsAccess(sentinel, false)) task->dropAccess();
+            else sentinel.addTaskDep(task->addAccess(sentinel, false));
+        }
+    }
+
+    inline dep_t renameRead(Task* task, renaming_table& renaming, dep_t address)
+    {
+        auto found = renaming.buffers.find(address);
+        if (found == renaming.buffers.end()) return address;
+        const dep_t version = found->second.current;
+        if (version != address) task->_renamed.push_back({ address, version });
+        return version;
+    }
+
+    //A task that only writes the buffer takes a version without pending accesses, instead of waiting for them
+    inline dep_t renameWrite(Task* task, renaming_table& renaming, dep_t address)
+    {
+        auto found = renaming.buffers.find(address);
+        if (found == renaming.buffers.end()) return address;
+        renamed_buffer& buffer = found->second;
+        const group_t group = task->getGroup();
+        const auto isFree = [&](dep_t version) { return getSentinelForGroup(version, group)._last.load(std::memory_order_acquire) == nullptr; };
+
+        dep_t version = buffer.current;
+        if (!isFree(version))
+        {
+            if (buffer.original != buffer.current && isFree(buffer.original)) version = buffer.original;
+            for (dep_t candidate : buffer.versions)
+                if (version == buffer.current && candidate != buffer.current && isFree(candidate)) version = candidate;
+            if (version == buffer.current && buffer.versions.size() + 1 < buffer.maxVersions)
+            {
+                version = (dep_t)::operator new(buffer.bytes, std::align_val_t(cacheLineSize));
+                buffer.versions.push_back(version);
+            }
+            buffer.current = version;
+        }
+        if (version != address) task->_renamed.push_back({ address, version });
+        return version;
+    }
+
+    template<typename R>
+    static constexpr bool isFutureResult = !std::is_void<R>::value && !std::is_same<R, task_fin_t>::value;
+
+    //Creates a task released by its predecessors (all of them, or the first one if any is set) instead of by dependences
+    template<typename R, typename F>
+    inline Future<R> createContinuation(Task* const* predecessors, size_t count, bool any, group_t group, F&& body)
+    {
+        Task* task = getPreallocatedTask();
+        task->prepare([task, body = std::forward<F>(body)]() mutable { task->template runForResult<R>([&] { return body(task); }); }, group);
+        Future<R> future(task);
+
+        if (any) task->increaseCountdown();
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!any)
+            {
+                if (predecessors[i]->addSuccessor(task)) task->increaseCountdown();
+            }
+            else if (!predecessors[i]->addSuccessor(task, (uint32_t)i) && task->claimAny((uint32_t)i)) task->releaseCountdown();
+        }
+
+        registerTask(task, deps(), deps());
+        if (_minirunDisabled) future.wait();
+        return future;
+    }
+#if defined(MINIRUN_FILE_IO)
+    inline IoEngine& ioEngine()
+    {
+        std::call_once(_ioEngineOnce, [this] { _ioEngine.reset(new IoEngine()); });
+        return *_ioEngine;
+    }
+
+    inline Future<ssize_t> createIoTask(bool write, int fd, off_t offset, size_t length, void* buffer, const dep_list_t& in, const dep_list_t& out, group_t group)
+    {
+        auto request = std::make_shared<io_request>();
+        request->write = write;
+        request->fd = fd;
+        request->offset = offset;
+        request->buffer = { buffer, length };
+
+        IoEngine& engine = ioEngine();
+        Task* task = getPreallocatedTask();
+        task->prepare([&engine, request] { engine.submit(request.get()); },
+            [&engine, task, request] {
+                engine.poll();
+                if (!request->done.load(std::memory_order_acquire)) return false;
+                task->template runForResult<ssize_t>([&] { return request->result; });
+                return true;
+            }, group);
+        Future<ssize_t> future(task);
+        registerTask(task, in, out);
+        if (_minirunDisabled) future.wait();
+        return future;
+    }
+#endif
+public:
+
+    inline void registerTask(Task* task, const dep_list_t& in, const dep_list_t& out)
+    {
+        group_t group = task->getGroup();
+
+        task->_groupState = &getGroupState(group);
+        increaseRunningTasks(*task->_groupState);
+
+        task->reserveAccesses(in.size() + out.size());
+        renaming_table* renaming = task->_groupState->_renaming.load(std::memory_order_acquire);
+        if (renaming == nullptr) registerAccesses(task, in, out);
+        else
+        {
+            //The versions are chosen and linked to their sentinels atomically, so a free version is not taken twice
+            lock_guard guard(renaming->mtx);
+            registerAccesses(task, in, out, renaming);
+        }
+
+        task->activate();
+    }
+
+    //INLINE EXECUTION
+    //Cutoffs for tasks too small to pay for a task record, as the if and final clauses of OpenMP
+    struct if_clause { bool condition; };    //false runs the task in the creating thread
+    struct final_clause { bool condition; }; //true runs the tasks created inside the task in its thread
+
+    //CONSTRUCTORS FOR TASKS WITH SYNCHRONOUS FINALIZATION
+    //The function objects are taken by value and moved into the task record
+
+    inline void createTask(task_fun_t async_fun, group_t group)
+    {
+        createTask(std::move(async_fun), deps(), deps(), group);
+    }
+
+    inline void createTask(task_fun_t async_fun)
+    {
+        createTask(std::move(async_fun), deps(), deps());
+    }
+
+    inline void createTask(task_fun_t async_fun, const dep_list_t& in, const dep_list_t& out, group_t group = defaultGroup)
+    {
+        if (_minirunDisabled) return async_fun();
+        if (_finalRuntime == this)
+        {
+            //Inside a final task, the ones with dependences wait for them in place
+            if (in.empty() && out.empty()) return runInline(async_fun, group);
+            Task* task = getPreallocatedTask()->prepare(std::move(async_fun), group);
+            task->_final = true;
+            return runUndeferred(task, in, out);
+        }
+
+        call_site* site = nullptr;
+        #if defined(MINIRUN_AUTO_INLINE)
+        const int64_t threshold = _autoInlineNanos.load(std::memory_order_acquire);
+        if (threshold != 0 && (site = callSite(async_fun.target_type())) != nullptr)
+        {
+            //Only while there are enough ready tasks to keep every worker busy
+            if (in.empty() && out.empty() && site->isShorterThan(threshold) && _client._readyTasks.load(std::memory_order_relaxed) > (size_t)_pool->numThreads())
+                return runInline(async_fun, group, site);
+        }
+        #endif
+
+        Task* task = getPreallocatedTask()->prepare(std::move(async_fun), group);
+        task->_site = site;
+        registerTask(task, in, out);
+    }
+
+    //A task with the condition false runs in this thread once its dependences are satisfied, before createTask returns.
+    //Without dependences it does not need a task record.
+    inline void createTask(task_fun_t async_fun, const dep_list_t& in, const dep_list_t& out, if_clause clause, group_t group = defaultGroup)
+    {
+        if (clause.condition || _minirunDisabled || _finalRuntime == this) return createTask(std::move(async_fun), in, out, group);
+        if (in.empty() && out.empty()) return runInline(async_fun, group);
+
+        runUndeferred(getPreallocatedTask()->prepare(std::move(async_fun), group), in, out);
+    }
+
+    inline void createTask(task_fun_t async_fun, if_clause clause, group_t group = defaultGroup)
+    {
+        createTask(std::move(async_fun), deps(), deps(), clause, group);
+    }
+
+    //The tasks created while a final task runs are run inline by its thread, and so are the ones they create
+    inline void createTask(task_fun_t async_fun, const dep_list_t& in, const dep_list_t& out, final_clause clause, group_t group = defaultGroup)
+    {
+        if (!clause.condition || _minirunDisabled || _finalRuntime == this) return createTask(std::move(async_fun), in, out, group);
+
+        Task* task = getPreallocatedTask()->prepare(std::move(async_fun), group);
+        task->_final = true;
+        registerTask(task, in, out);
+    }
+
+    inline void createTask(task_fun_t async_fun, final_clause clause, group_t group = defaultGroup)
+    {
+        createTask(std::move(async_fun), deps(), deps(), clause, group);
+    }
+
+    //Inlines the tasks of the call sites whose mean duration is under the threshold while the workers have enough ready
+    //tasks, a zero threshold disables it. A call site is the type of the function object, a lambda expression, so
+    //without RTTI there are no call sites and it has no effect.
+    inline void setAutoInline(std::chrono::nanoseconds threshold)
+    {
+        {
+            lock_guard guard(_running_tasks_group_lock);
+            if (_callSites == nullptr) _callSites.reset(new call_site[callSites]);
+        }
+        _autoInlineNanos.store(std::max<int64_t>(threshold.count(), 0), std::memory_order_release);
+    }
+
+    //The task runs in a thread of the executor, even when MiniRun is disabled
+    inline void createTask(task_fun_t async_fun, Executor& executor, group_t group = defaultGroup)
+    {
+        createTask(std::move(async_fun), deps(), deps(), executor, group);
+    }
+
+    inline void createTask(task_fun_t async_fun, const dep_list_t& in, const dep_list_t& out, Executor& executor, group_t group = defaultGroup)
+    {
+        Task* task = getPreallocatedTask()->prepare(std::move(async_fun), group);
+        task->_executor = &executor;
+        registerTask(task, in, out);
+        if (_minirunDisabled) waitAllTasks();
+    }
+
+
+    //CONSTRUCTORS FOR VALUE RETURNING TASKS
+
+    template<typename F, typename R = typename std::invoke_result<F&>::type, typename = typename std::enable_if<isFutureResult<R>>::type>
+    inline Future<R> createTask(F&& fun, group_t group)
+    {
+        return createTask(std::forward<F>(fun), deps(), deps(), group);
+    }
+
+    template<typename F, typename R = typename std::invoke_result<F&>::type, typename = typename std::enable_if<isFutureResult<R>>::type>
+    inline Future<R> createTask(F&& fun)
+    {
+        return createTask(std::forward<F>(fun), deps(), deps());
+    }
+
+    template<typename F, typename R = typename std::invoke_result<F&>::type, typename = typename std::enable_if<isFutureResult<R>>::type>
+    inline Future<R> createTask(F&& fun, const dep_list_t& in, const dep_list_t& out, group_t group = defaultGroup)
+    {
+        Task* task = getPreallocatedTask();
+        task->prepare([task, fun = std::forward<F>(fun)]() mutable { task->template runForResult<R>(fun); }, group);
+        Future<R> future(task);
+        if (_finalRuntime == this && !_minirunDisabled)
+        {
+            //Inside a final task, it needs the record for its result but it runs now and is final as well
+            task->_final = true;
+            runUndeferred(task, in, out);
+            return future;
         }
+        registerTask(task, in, out);
+        if (_minirunDisabled) future.wait();
+        return future;
+    }
+
+    template<typename F, typename R = typename std::invoke_result<F&>::type, typename = typename std::enable_if<isFutureResult<R>>::type>
+    inline Future<R> createTask(F&& fun, Executor& executor, group_t group = defaultGroup)
+    {
+        return createTask(std::forward<F>(fun), deps(), deps(), executor, group);
+    }
+
+    template<typename F, typename R = typename std::invoke_result<F&>::type, typename = typename std::enable_if<isFutureResult<R>>::type>
+    inline Future<R> createTask(F&& fun, const dep_list_t& in, const dep_list_t& out, Executor& executor, group_t group = defaultGroup)
+    {
+        Task* task = getPreallocatedTask();
+        task->prepare([task, fun = std::forward<F>(fun)]() mutable { task->template runForResult<R>(fun); }, group);
+        task->_executor = &executor;
+        Future<R> future(task);
+        registerTask(task, in, out);
+        if (_minirunDisabled) future.wait();
+        return future;
+    }
+
+#if defined(MINIRUN_FILE_IO)
+    //ASYNCHRONOUS FILE I/O
+    //The transfer is submitted when the dependences are satisfied and the task releases them when it completes, without
+    //blocking a worker. The result is the number of bytes transferred or -errno, as pread and pwrite.
+
+    inline Future<ssize_t> createReadTask(int fd, off_t offset, size_t length, void* buffer, const dep_list_t& out, group_t group = defaultGroup)
+    {
+        return createIoTask(false, fd, offset, length, buffer, deps(), out, group);
+    }
+
+    inline Future<ssize_t> createReadTask(int fd, off_t offset, size_t length, void* buffer, const dep_list_t& in, const dep_list_t& out, group_t group = defaultGroup)
+    {
+        return createIoTask(false, fd, offset, length, buffer, in, out, group);
+    }
+
+    inline Future<ssize_t> createWriteTask(int fd, off_t offset, size_t length, const void* buffer, const dep_list_t& in, group_t group = defaultGroup)
+    {
+        return createIoTask(true, fd, offset, length, const_cast<void*>(buffer), in, deps(), group);
+    }
+
+    inline Future<ssize_t> createWriteTask(int fd, off_t offset, size_t length, const void* buffer, const dep_list_t& in, const dep_list_t& out, group_t group = defaultGroup)
+    {
+        return createIoTask(true, fd, offset, length, const_cast<void*>(buffer), in, out, group);
+    }
+
+    //True when the transfers go through io_uring instead of the fallback threads
+    inline bool usesIoUring()
+    {
+        return ioEngine().usesRing();
+    }
+#endif
+
+    //PIPELINES
+    template<typename T>
+    inline Pipeline<T> pipeline(size_t tokens, group_t group = defaultGroup)
+    {
+        return Pipeline<T>(*this, tokens, group);
+    }
+
+    //The combinators run in the group of the first future, the vector versions need at least one future
+    template<typename... T>
+    static inline Future<std::tuple<Future<T>...>> when_all(const Future<T>&... futures)
+    {
+        Task* predecessors[] = { futures._task... };
+        return predecessors[0]->_targetRuntime.template createContinuation<std::tuple<Future<T>...>>(predecessors, sizeof...(T), false, predecessors[0]->_group,
+            [inputs = std::make_tuple(futures...)](Task*) { return inputs; });
+    }
+
+    template<typename T>
+    static inline Future<std::vector<Future<T>>> when_all(const std::vector<Future<T>>& futures)
+    {
+        assert(!futures.empty() && "MiniRun: the combinators need at least one future");
+        std::vector<Task*> predecessors;
+        for (const auto& future : futures) predecessors.push_back(future._task);
+        return predecessors[0]->_targetRuntime.template createContinuation<std::vector<Future<T>>>(predecessors.data(), predecessors.size(), false, predecessors[0]->_group,
+            [inputs = futures](Task*) { return inputs; });
+    }
+
+    //The result is the index of the first future that finished
+    template<typename... T>
+    static inline Future<size_t> when_any(const Future<T>&... futures)
+    {
+        Task* predecessors[] = { futures._task... };
+        return predecessors[0]->_targetRuntime.template createContinuation<size_t>(predecessors, sizeof...(T), true, predecessors[0]->_group,
+            [](Task* task) { return (size_t)task->_anyWinner.load(); });
+    }
+
+    template<typename T>
+    static inline Future<size_t> when_any(const std::vector<Future<T>>& futures)
+    {
+        assert(!futures.empty() && "MiniRun: the combinators need at least one future");
+        std::vector<Task*> predecessors;
+        for (const auto& future : futures) predecessors.push_back(future._task);
+        return predecessors[0]->_targetRuntime.template createContinuation<size_t>(predecessors.data(), predecessors.size(), true, predecessors[0]->_group,
+            [](Task* task) { return (size_t)task->_anyWinner.load(); });
+    }
+
+    //SENDERS
+    //Scheduler whose senders start their work in tasks of this runtime and group, see the scheduler class
+    inline scheduler get_scheduler(group_t group = defaultGroup)
+    {
+        return scheduler(this, group);
+    }
+
+    template<typename S, typename F, typename = typename std::enable_if<isSender<S>::value>::type>
+    static inline then_sender<typename std::decay<S>::type, typename std::decay<F>::type> then(S&& sender, F&& fun)
+    {
+        return { typename std::decay<S>::type(std::forward<S>(sender)), typename std::decay<F>::type(std::forward<F>(fun)) };
+    }
+
+    template<typename F>
+    static inline then_closure<typename std::decay<F>::type> then(F&& fun)
+    {
+        return { std::forward<F>(fun) };
+    }
+
+    template<typename S, typename F, typename = typename std::enable_if<isSender<S>::value>::type>
+    static inline bulk_sender<typename std::decay<S>::type, typename std::decay<F>::type> bulk(S&& sender, size_t count, F&& fun)
+    {
+        return { typename std::decay<S>::type(std::forward<S>(sender)), count, typename std::decay<F>::type(std::forward<F>(fun)) };
+    }
+
+    template<typename F>
+    static inline bulk_closure<typename std::decay<F>::type> bulk(size_t count, F&& fun)
+    {
+        return { count, std::forward<F>(fun) };
+    }
+
+    template<typename... S, typename = typename std::enable_if<(sizeof...(S) > 0) && (isSender<S>::value && ...)>::type>
+    static inline when_all_sender<typename std::decay<S>::type...> when_all(S&&... senders)
+    {
+        return { typename std::decay<S>::type(std::forward<S>(senders))... };
+    }
+
+    //Starts the sender and runs tasks of its runtime until it completes. Returns its values, rethrows its error and
+    //throws if it was stopped.
+    template<typename S, typename = typename std::enable_if<isSender<S>::value>::type>
+    static inline typename std::decay<S>::type::values sync_wait(S&& sender)
+    {
+        using values = typename std::decay<S>::type::values;
+        MiniRun& runtime = sender.get_scheduler().runtime();
+        sync_wait_state<values> state;
+        auto operation = std::forward<S>(sender).connect(sync_wait_receiver<values>{ &state });
+        operation.start();
+        while (!state.done.load(std::memory_order_acquire)) runtime.runTaskExternalThread();
+
+        if (state.error) std::rethrow_exception(state.error);
+        if (state.stopped) throw std::runtime_error("MiniRun: task cancelled");
+        return std::move(*state.values);
+    }
 
+#if defined(MINIRUN_COROUTINES)
+    //CONSTRUCTORS FOR COROUTINE TASKS
 
-        inline void activate()
-        {
-            decreaseCountdown();
-        }
-        inline void operator()()
-        {
+    inline void createTask(Coroutine&& coroutine, group_t group)
+    {
+        createTask(std::move(coroutine), deps(), deps(), group);
+    }
 
-            const auto finalizeTask = [&] {
-                onFinish();
-                _targetRuntime.releaseTask(this);
-                _targetRuntime.decreaseRunningTasks(_group);
-            };
+    inline void createTask(Coroutine&& coroutine)
+    {
+        createTask(std::move(coroutine), deps(), deps());
+    }
 
-            if (!_hasAsynchronousFinalization)
-            {
-                _fun();
-                finalizeTask();
-            }
-            else
-            {
+    //The coroutine counts as a running task of the group until it finishes, the first step holds the dependences
+    inline void createTask(Coroutine&& coroutine, const dep_list_t& in, const dep_list_t& out, group_t group = defaultGroup)
+    {
+        std::coroutine_handle<Coroutine::promise_type> handle = coroutine._handle;
+        coroutine._handle = nullptr;
 
-                if (!_isAwaitingForFinalization)
-                {
-                    _isAwaitingForFinalization = true;
+        Coroutine::promise_type& promise = handle.promise();
+        promise._runtime = this;
+        promise._group = group;
+        promise._state = &getGroupState(group);
+        increaseRunningTasks(*promise._state);
 
-                    if (_isFunFin) _fin = _fun_fin();
-                    else _fun();
-                }
+        Task* task = getPreallocatedTask()->prepare([handle] {
+            if (!isCancelled()) return handle.resume();
+            MiniRun& runtime = *handle.promise()._runtime;
+            group_state& state = *handle.promise()._state;
+            handle.destroy();
+            runtime.decreaseRunningTasks(state);
+        }, group);
+        task->_ignoresCancellation = true;
+        registerTask(task, in, out);
+        if (_minirunDisabled) taskwait(group);
+    }
 
-                if (_fin()) finalizeTask();
-                else _targetRuntime.addTask(this);
+    //co_await suspends the coroutine until the tasks of the group have finished
+    inline taskwait_awaiter async_taskwait(group_t group)
+    {
+        return { *this, getGroupState(group) };
+    }
 
-            }
+    //co_await suspends the coroutine until it can access the dependences, in the group of the coroutine
+    inline deps_awaiter deps_ready(const dep_list_t& in, const dep_list_t& out)
+    {
+        return { *this, in, out };
+    }
+#endif
 
-        }
+    //CONSTRUCTORS FOR TASKS WITH ASYNCHRONOUS FINALIZATIONS
 
-        inline void setGroup(group_t group)
-        {
-            _group = group;
-        }
-        inline group_t getGroup() const
-        {
-            return _group;
-        }
-        inline void decreaseAfterExecution(sentinel_access_type_counter* sentinel)
-        {
-            _decreaseInCounterAfterExecution.push_back(sentinel);
-        }
+    inline void createTask(task_fun_t async_fun, task_fin_t async_fin, group_t group)
+    {
+        createTask(std::move(async_fun), std::move(async_fin), deps(), deps(), group);
+    }
 
-        inline void outAfterExecution(sentinel_access_type_counter* sentinel)
-        {
-            _processFinishOutAfterExecution.push_back(sentinel);
-        }
+    inline void createTask(task_fun_t async_fun, task_fin_t async_fin)
+    {
+        createTask(std::move(async_fun), std::move(async_fin), deps(), deps());
+    }
 
-        inline void increaseCountdown()
+    inline void createTask(task_fun_t async_fun, task_fin_t async_fin, const dep_list_t& in, const dep_list_t& out, group_t group = defaultGroup)
+    {
+        if (!_minirunDisabled)  registerTask(getPreallocatedTask()->prepare(std::move(async_fun), std::move(async_fin), group), in, out);
+        else
         {
-            lock_guard guard(_countdownMtx);
-            _countdownToRelease++;
+            async_fun();
+            while (async_fin());
         }
+    }
 
-        inline void decreaseCountdown()
-        {
-            lock_guard guard(_countdownMtx);
-            _countdownToRelease--;
-            if (_countdownToRelease == 0) _targetRuntime.addTask(this);
-        }
+    inline void createTask(task_fun_t async_fun, task_fin_t async_fin, const dep_list_t& in, const dep_list_t& out, Executor& executor, group_t group = defaultGroup)
+    {
+        Task* task = getPreallocatedTask()->prepare(std::move(async_fun), std::move(async_fin), group);
+        task->_executor = &executor;
+        registerTask(task, in, out);
+        if (_minirunDisabled) waitAllTasks();
+    }
 
-        inline void onFinish()
-        {
-            _taskHasFinished = true;
-            for (auto decrease : _decreaseInCounterAfterExecution) decrease->decreaseIn(this);
-            for (auto post : _processFinishOutAfterExecution) post->processSingleOut();
+    //CONSTRUCTOR FOR TASKS WITH DYNAMIC ASYNCHRONOUS FINALIZATION
+    inline void createTask(task_fun_fin_t async_fun_fin, group_t group)
+    {
+        createTask(std::move(async_fun_fin), deps(), deps(), group);
+    }
 
-        }
-    };
+    inline void createTask(task_fun_fin_t async_fun_fin)
+    {
+        createTask(std::move(async_fun_fin), deps(), deps());
+    }
 
-private:
+    inline void createTask(task_fun_fin_t async_fun_fin, const dep_list_t& in, const dep_list_t& out, group_t group = defaultGroup)
+    {
+        if (!_minirunDisabled)  registerTask(getPreallocatedTask()->prepare(std::move(async_fun_fin), group), in, out);
+        else
+        {
+            auto fin = async_fun_fin();
+            while (fin());
+        }
+    }
 
-    inline void releaseTask(Task* task)
+    inline void createTask(task_fun_fin_t async_fun_fin, const dep_list_t& in, const dep_list_t& out, Executor& executor, group_t group = defaultGroup)
     {
-        lock_guard guard(_preallocTasksMtx);
-        _preallocatedTasks.push(task);
+        Task* task = getPreallocatedTask()->prepare(std::move(async_fun_fin), group);
+        task->_executor = &executor;
+        registerTask(task, in, out);
+        if (_minirunDisabled) waitAllTasks();
     }
 
-    inline Task* getPreallocatedTask()
+    //Waits for the tasks of the group, rethrows the first exception thrown by one of them and clears its cancellation
+    inline void taskwait(group_t group)
     {
-        lock_guard guard(_preallocTasksMtx);
-        if (_preallocatedTasks.size() == 0)
-            for (int i = 0; i < 100; ++i)
-                _preallocatedTasks.push(new Task(*this));
 
-        Task* task = _preallocatedTasks.front();
-        _preallocatedTasks.pop();
-        return task;
+        group_state& state = getGroupState(group);
+        while (state._running != 0)
+            runTaskExternalThread();
+
+        state.endTaskwait();
     }
 
+    //Returns false without waiting if the group has running tasks, otherwise ends as taskwait(group)
+    inline bool try_taskwait(group_t group)
+    {
+        group_state& state = getGroupState(group);
+        if (state._running != 0) return false;
+        state.endTaskwait();
+        return true;
+    }
 
+    //Runs tasks while waiting as taskwait(group), returns false if the group still has running tasks after the timeout.
+    //The task being run when the time is up is finished first.
+    template<typename Rep, typename Period>
+    inline bool taskwait_for(group_t group, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        group_state& state = getGroupState(group);
+        while (state._running != 0)
+        {
+            if (std::chrono::steady_clock::now() >= deadline) return false;
+            runTaskExternalThread();
+        }
 
-    inline  std::pair<SpinLock, sentinel_map_type>& getSentinelPairForGroup(group_t group)
+        state.endTaskwait();
+        return true;
+    }
+#if defined(MINIRUN_GROUP_EVENTFD)
+    //Eventfd that is written each time the group runs out of tasks, to wait for it in an event loop with poll or epoll.
+    //It is owned by the runtime, -1 if it cannot be created. After reading it, try_taskwait tells if the group is still empty and rethrows its exception.
+    inline int completionFd(group_t group)
     {
-        lock_guard guard(_sentinel_map_group_lock);
-        return _sentinel_value_map[group];
+        return getGroupState(group).eventFd();
     }
+#endif
 
-    inline sentinel_access_type_counter& getSentinelForGroup(dep_t sentinel, group_t group)
+    inline void taskwait()
     {
-        auto& map = getSentinelPairForGroup(group);
-        lock_guard guard(map.first);
-        return map.second[sentinel];
+        waitAllTasks();
 
+        std::exception_ptr exception;
+        {
+            lock_guard guard(_running_tasks_group_lock);
+            for (auto& group : _groups)
+            {
+                group.second.restoreRenamed();
+                group.second._cancelled = false;
+                std::exception_ptr groupException = group.second.takeException();
+                if (!exception) exception = groupException;
+            }
+        }
+        if (exception) std::rethrow_exception(exception);
     }
 
-    inline std::atomic<num_tasks_t>& getGroupRunningTasksCounter(group_t group)
+    //Limits the number of ready and blocked tasks, 0 disables the limit. The default is taken from MINIRUN_MAX_IN_FLIGHT_TASKS
+    inline void setMaxInFlightTasks(num_tasks_t maxInFlight)
     {
-        lock_guard guard(_running_tasks_group_lock);
-        std::atomic<num_tasks_t>& ref = *(&_running_tasks[group]);
-        return ref;
+        _max_in_flight_tasks = std::max<num_tasks_t>(maxInFlight, 0);
     }
 
-    inline void increaseRunningTasks(group_t group)
+    //The groups with ready tasks take turns, each one runs up to weight tasks in its turn. The groups of the latency class
+    //are served before the others, so they should only have short tasks.
+    inline void setGroupScheduling(group_t group, num_tasks_t weight, bool latency = false)
     {
-        _global_running_tasks++;
-        lock_guard guard(_running_tasks_group_lock);
-        _running_tasks[group]++;
+        _pool->setGroupScheduling(&_client, getGroupState(group), std::max<num_tasks_t>(weight, 1), latency);
     }
 
-    inline void decreaseRunningTasks(group_t group)
+    //THREADS
+    //The pool changes its size at runtime, a shared pool changes for all its runtimes. The caller of taskwait runs
+    //tasks too, so the default is one thread less than the cpus available to the process.
+
+    inline int numThreads() const
     {
-        _global_running_tasks--;
-        lock_guard guard(_running_tasks_group_lock);
-        _running_tasks[group]--;
+        return _pool->numThreads();
     }
 
-    inline void addTask(Task* task)
+    inline void setNumThreads(int numThreads)
     {
-        _pool.addTask(task);
+        _pool->setNumThreads(numThreads);
     }
-public:
 
-    inline void registerTask(Task* task, const dep_list_t& in, const dep_list_t& out)
+    //The pool grows while ready tasks wait for busy workers and retires workers after a sustained idle period.
+    //The maximum is capped by the cpus available to the process, which include the cgroup quota. They are read again
+    //every second, so the pool follows a change of the quota.
+    inline void setAutoThreads(int minThreads = 0, int maxThreads = -1)
     {
-        group_t group = task->getGroup();
-
-        increaseRunningTasks(group);
+        _pool->setAutoThreads(minThreads, maxThreads);
+    }
 
-        for (const uintptr_t i : in) getSentinelForGroup(i, group).addTaskDep(task, true);
-        for (const uintptr_t i : out) getSentinelForGroup(i, group).addTaskDep(task, false);
+    //Tasks of the group that have not started are dropped until the next taskwait on the group (or a global one)
+    inline void cancel(group_t group)
+    {
+        getGroupState(group)._cancelled = true;
+    }
 
-        task->activate();
+    //Cheap check to be polled from a running task, true if the group of the task was cancelled
+    static inline bool isCancelled()
+    {
+        if (_inlineGroup != nullptr) return _inlineGroup->_cancelled.load(std::memory_order_relaxed);
+        return _current_task != nullptr && _current_task->_groupState->_cancelled.load(std::memory_order_relaxed);
     }
 
-    //CONSTRUCTORS FOR TASKS WITH SYNCHRONOUS FINALIZATION
+    //RENAMING
+    //The tasks of the group that write the buffer without reading it (out and not in) get a free version of it when
+    //the current one still has pending accesses, so they do not wait for the previous readers and writers. The tasks
+    //created after them access the new version. Up to maxVersions copies (including the buffer) are used, then the
+    //writers wait as usual. The tasks reach their version with MiniRun::renamed(buffer), and taskwait copies the
+    //last version back to the buffer. The buffer is registered before its tasks are created. A free version is not
+    //initialized, so a task with the buffer in out and not in has to overwrite all of it.
+    template<typename T>
+    inline void enableRenaming(T* buffer, size_t count, group_t group = defaultGroup, size_t maxVersions = 4)
+    {
+        group_state& state = getGroupState(group);
+        renaming_table* renaming = state._renaming.load(std::memory_order_acquire);
+        if (renaming == nullptr)
+        {
+            renaming_table* created = new renaming_table();
+            if (state._renaming.compare_exchange_strong(renaming, created)) renaming = created;
+            else delete created;
+        }
+        lock_guard guard(renaming->mtx);
+        renaming->buffers.try_emplace((dep_t)buffer, (dep_t)buffer, count * sizeof(T), maxVersions);
+    }
 
-    inline void createTask(const task_fun_t& async_fun, group_t group)
+    //Version of the buffer used by the running task, the buffer itself outside of tasks or when it was not renamed
+    template<typename T>
+    static inline T* renamed(T* buffer)
     {
-        createTask(async_fun, deps(), deps(), group);
+        if (_current_task == nullptr || _inlineGroup != nullptr) return buffer;
+        for (const auto& renaming : _current_task->_renamed)
+            if (renaming.original == (dep_t)buffer) return (T*)renaming.version;
+        return buffer;
     }
 
-    inline void createTask(const task_fun_t& async_fun)
+    //SCRATCH MEMORY
+    //Memory of the thread that runs the task, bumped from its arena and released when the task finishes (each step of the
+    //tasks with asynchronous finalization and of the coroutines). Outside of tasks it is released by the enclosing
+    //scratch_scope. It is not initialized and no destructor is run. The alignment is a power of two, and a size that does
+    //not fit in size_t throws std::bad_array_new_length.
+    template<typename T>
+    static inline T* scratch(size_t count, size_t alignment = std::max(alignof(T), alignof(std::max_align_t)))
     {
-        createTask(async_fun, deps(), deps());
+        static_assert(std::is_trivially_destructible<T>::value, "MiniRun: the scratch memory is released without destroying its elements");
+        scratch_thread& thread = _scratch;
+        return (T*)bumpScratch(thread.position, thread.first, count, sizeof(T), alignment);
     }
 
-    inline void createTask(const task_fun_t& async_fun, const dep_list_t& in, const dep_list_t& out, group_t group = defaultGroup)
+    //Releases the scratch memory allocated by this thread during its lifetime, for long tasks and for the threads that
+    //are not running a task
+    class scratch_scope
+    {
+        scratch_position _mark;
+    public:
+        scratch_scope() : _mark(_scratch.position) {}
+        ~scratch_scope() { _scratch.position = _mark; }
+        scratch_scope(const scratch_scope&) = delete;
+        scratch_scope& operator=(const scratch_scope&) = delete;
+    };
+
+    //Size of the blocks of the arenas allocated from now on, 1MB by default. With huge pages they are rounded to 2MB and
+    //advised to be backed by transparent huge pages (linux).
+    static inline void configureScratch(size_t blockBytes, bool hugePages = false)
     {
-        if (!_minirunDisabled)
-            return registerTask(getPreallocatedTask()->prepare(async_fun, group), in, out);
-        else async_fun();
+        _scratchBlockBytes = blockBytes;
+        _scratchHugePages = hugePages;
     }
 
+    //Arena for the memory that has to outlive the task that allocates it, everything is released on reset or destruction
+    class Arena
+    {
+        SpinLock         _lock{ lock_site::other };
+        scratch_position _position;
+        scratch_block*   _first = nullptr;
+    public:
+        Arena() = default;
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+        ~Arena() { deleteScratchBlocks(_first); }
+
+        template<typename T>
+        inline T* allocate(size_t count, size_t alignment = std::max(alignof(T), alignof(std::max_align_t)))
+        {
+            static_assert(std::is_trivially_destructible<T>::value, "MiniRun: the arena is released without destroying its elements");
+            lock_guard guard(_lock);
+            return (T*)bumpScratch(_position, _first, count, sizeof(T), alignment);
+        }
 
-    //CONSTRUCTORS FOR TASKS WITH ASYNCHRONOUS FINALIZATIONS
+        //The blocks are kept for the next allocations
+        inline void reset()
+        {
+            lock_guard guard(_lock);
+            _position = scratch_position();
+        }
+    };
+
+    //INTROSPECTION
+    //Tasks created by this thread while the label is alive carry it, the dumps show the label of the running tasks.
+    //The string is not copied.
+    class task_label
+    {
+        const char* _previous;
+    public:
+        task_label(const char* label) : _previous(_creationLabel) { _creationLabel = label; }
+        ~task_label() { _creationLabel = _previous; }
+        task_label(const task_label&) = delete;
+        task_label& operator=(const task_label&) = delete;
+    };
 
-    inline void createTask(const task_fun_t& async_fun, const task_fin_t& async_fin, group_t group)
+    //Writes what the threads are running, the state of the groups of every runtime, the addresses with pending
+    //accesses and the tasks queued in the executors. The running tasks are only known while the dumps are enabled.
+    static void dumpState(std::ostream& out = std::cerr)
     {
-        createTask(async_fun, async_fin, deps(), deps(), group);
+        introspection_registry& registry = introspection();
+        std::lock_guard<std::mutex> guard(registry.mtx);
+        const int64_t now = steadyNanoseconds();
+        char line[256];
+
+        #if defined(MINIRUN_SIGNAL_DUMP)
+        snprintf(line, sizeof(line), "==== MiniRun state of process %d ====\n", (int)getpid());
+        #else
+        snprintf(line, sizeof(line), "==== MiniRun state ====\n");
+        #endif
+        out << line;
+        for (thread_record* record : registry.threads)
+        {
+            const int64_t since = record->since.load(std::memory_order_relaxed);
+            if (since == 0) continue;
+            const char* label = record->label.load(std::memory_order_relaxed);
+            snprintf(line, sizeof(line), " (%s) runs %s of runtime %p group %u for %.3f ms\n", record->kind.load(std::memory_order_relaxed), label != nullptr ? label : "an unlabelled task",
+                (const void*)record->runtime.load(std::memory_order_relaxed), record->group.load(std::memory_order_relaxed), (now - since) / 1e6);
+            out << "thread " << record->id << line;
+        }
+        for (MiniRun* runtime : registry.runtimes) runtime->dumpRuntime(out, now);
+        for (Executor* executor : registry.executors) out << "executor " << executor->name() << ": " << executor->queuedTasks() << " tasks queued\n";
+        out.flush();
     }
 
-    inline void createTask(const task_fun_t& async_fun, const task_fin_t& async_fin)
+#if defined(MINIRUN_SIGNAL_DUMP)
+    //Installs a handler that appends the state to the file each time the process receives the signal,
+    //for example with kill -USR1 <pid>. It also starts recording the tasks that run in each thread.
+    static bool enableDumpOnSignal(int signal = SIGUSR1, const std::string& path = "minirun.dump")
     {
-        createTask(async_fun, async_fin, deps(), deps());
+        introspection_registry& registry = introspection();
+        {
+            std::lock_guard<std::mutex> guard(registry.mtx);
+            registry.path = path;
+            if (registry.pipe[0] < 0)
+            {
+                if (pipe(registry.pipe) != 0) return false;
+                fcntl(registry.pipe[0], F_SETFD, FD_CLOEXEC);
+                fcntl(registry.pipe[1], F_SETFD, FD_CLOEXEC);
+                fcntl(registry.pipe[1], F_SETFL, O_NONBLOCK); //a burst of signals must not block the handler
+                std::thread(dumperThread).detach();
+            }
+        }
+        _dumpsEnabled = true;
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = dumpSignalHandler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        return sigaction(signal, &action, nullptr) == 0;
     }
+#endif
 
-    inline void createTask(const task_fun_t& async_fun, const task_fin_t& async_fin, const dep_list_t& in, const dep_list_t& out, group_t group = defaultGroup)
+    //Acquisitions, contended acquisitions and time waited for each lock of the runtimes, requires MINIRUN_LOCK_STATS
+    static void printLockStats(std::ostream& out = std::cerr)
     {
-        if (!_minirunDisabled)  registerTask(getPreallocatedTask()->prepare(async_fun, async_fin, group), in, out);
-        else
+        #if defined(MINIRUN_LOCK_STATS)
+        static const char* names[] = { "thread pool", "sentinel groups", "sentinel map", "groups", "group waiters", "group exception", "task notify", "preallocated tasks", "io ring", "other" };
+        out << "lock                  acquisitions   contended   wait(us)   max wait(us)\n";
+        for (size_t i = 0; i < (size_t)lock_site::count; ++i)
         {
-            async_fun();
-            while (async_fin());
+            const lock_site_stats& stats = lockStats((lock_site)i);
+            char line[128];
+            snprintf(line, sizeof(line), "%-20s %13llu %11llu %10.1f %14.1f\n", names[i],
+                (unsigned long long)stats.acquisitions.load(), (unsigned long long)stats.contended.load(),
+                stats.waitNanoseconds.load() / 1000.0, stats.maxWaitNanoseconds.load() / 1000.0);
+            out << line;
         }
+        #else
+        out << "MiniRun: lock statistics are disabled, define MINIRUN_LOCK_STATS before including MiniRun.hpp\n";
+        #endif
     }
 
-    //CONSTRUCTOR FOR TASKS WITH DYNAMIC ASYNCHRONOUS FINALIZATION
-    inline void createTask(const task_fun_fin_t& async_fun_fin, group_t group)
+    //From now on every thread reads its counters at the start and the end of each task and adds them to the task label.
+    //Returns whether the hardware counters could be opened in the calling thread, without them only the times are recorded.
+    static bool enablePerfCounters()
     {
-        createTask(async_fun_fin, deps(), deps(), group);
+        _perfEnabled = true;
+        return currentPerfThread().hardware();
     }
 
-    inline void createTask(const task_fun_fin_t& async_fun_fin)
+    static void disablePerfCounters()
     {
-        createTask(async_fun_fin, deps(), deps());
+        _perfEnabled = false;
     }
 
-    inline void createTask(const task_fun_fin_t& async_fun_fin, const dep_list_t& in, const dep_list_t& out, group_t group = defaultGroup)
+    //Tasks, time and counters of each label, with a line per thread that ran them. The labels are sorted by their time.
+    static void printPerfCounters(std::ostream& out = std::cerr)
     {
-        if (!_minirunDisabled)  registerTask(getPreallocatedTask()->prepare(async_fun_fin, group), in, out);
-        else
+        struct thread_totals { size_t index; const perf_thread* thread; perf_totals totals; };
+        struct label_totals { const char* label; perf_totals totals; bool counted[perfEvents]; std::vector<thread_totals> threads; };
+        std::vector<label_totals> labels;
         {
-            auto fin = async_fun_fin();
-            while (fin());
+            introspection_registry& registry = introspection();
+            std::lock_guard<std::mutex> guard(registry.mtx);
+            for (size_t index = 0; index < registry.perfThreads.size(); ++index)
+            {
+                perf_thread* thread = registry.perfThreads[index];
+                lock_guard threadGuard(thread->lock);
+                for (const auto& item : thread->labels)
+                {
+                    auto it = std::find_if(labels.begin(), labels.end(), [&](const label_totals& l) { return l.label == item.first; });
+                    if (it == labels.end()) it = labels.insert(labels.end(), label_totals{ item.first, perf_totals{}, {}, {} });
+                    it->totals.tasks += item.second.tasks;
+                    it->totals.nanoseconds += item.second.nanoseconds;
+                    for (size_t i = 0; i < perfEvents; ++i)
+                    {
+                        it->totals.counters[i] += item.second.counters[i];
+                        it->counted[i] = it->counted[i] || thread->counted[i];
+                    }
+                    it->threads.push_back({ index, thread, item.second });
+                }
+            }
         }
-    }
+        std::sort(labels.begin(), labels.end(), [](const label_totals& a, const label_totals& b) { return a.totals.nanoseconds > b.totals.nanoseconds; });
 
-    inline void taskwait(group_t group)
-    {
+        auto print = [&](const char* name, const perf_totals& totals, const bool (&counted)[perfEvents])
+        {
+            char line[256], cycles[24] = "-", instructions[24] = "-", ipc[24] = "-", misses[24] = "-", switches[24] = "-";
+            if (counted[0]) snprintf(cycles, sizeof(cycles), "%.1f", totals.counters[0] / 1e6);
+            if (counted[1]) snprintf(instructions, sizeof(instructions), "%.1f", totals.counters[1] / 1e6);
+            if (counted[0] && counted[1] && totals.counters[0] > 0) snprintf(ipc, sizeof(ipc), "%.2f", (double)totals.counters[1] / totals.counters[0]);
+            if (counted[2]) snprintf(misses, sizeof(misses), "%llu", (unsigned long long)totals.counters[2]);
+            if (counted[3]) snprintf(switches, sizeof(switches), "%llu", (unsigned long long)totals.counters[3]);
+            snprintf(line, sizeof(line), "%-24s %9llu %11.3f %11s %11s %6s %12s %9s\n", name, (unsigned long long)totals.tasks,
+                totals.nanoseconds / 1e6, cycles, instructions, ipc, misses, switches);
+            out << line;
+        };
+
+        out << "label / thread                tasks    time(ms)   cycles(M)    instr(M)    IPC   LLC misses  switches\n";
+        for (const label_totals& label : labels)
+        {
+            print(label.label != nullptr ? label.label : "(unlabelled)", label.totals, label.counted);
+            for (const thread_totals& thread : label.threads)
+            {
+                char name[64];
+                snprintf(name, sizeof(name), "  %s %zu", thread.thread->kind, thread.index);
+                print(name, thread.totals, thread.thread->counted);
+            }
+        }
+        out.flush();
+    }
 
-        auto& runningTasksGroup = getGroupRunningTasksCounter(group);
-        while (runningTasksGroup != 0)
-            _pool.runTaskExternalThread();
+    //TASKLOOP
+    //The range [b, e) is split in chunks as in OpenMP: with a grainsize each chunk has between grainsize and twice
+    //grainsize iterations, with num_tasks there are that many chunks (or one per iteration). Both split the range
+    //evenly, so the chunks have the same size when it divides the range.
+    struct grainsize { size_t iterations; };
+    struct num_tasks { size_t chunks; };
 
+    //The body receives the range of its chunk (b, e) or each index. The tasks join the group without a barrier, and the
+    //dependences of each chunk come from in(b, e) and out(b, e), so a loop can wait for parts of the previous ones.
+    template<typename T, typename Partition, typename Body>
+    inline void taskloop(T b, T e, Partition partition, const Body& body, group_t group = defaultGroup)
+    {
+        taskloop(b, e, partition, body, [](T, T) { return deps(); }, [](T, T) { return deps(); }, group);
     }
 
-    inline void taskwait()
+    template<typename T, typename Partition, typename Body, typename InFunction, typename OutFunction>
+    inline void taskloop(T b, T e, Partition partition, const Body& body, const InFunction& in, const OutFunction& out, group_t group = defaultGroup)
     {
-        while (_global_running_tasks != 0)
-            _pool.runTaskExternalThread();
+        static_assert(std::is_integral<T>::value, "taskloop iterates over an integral range");
+        if (!(b < e)) return;
+        const unsigned long long iterations = (unsigned long long)(e - b);
+        unsigned long long chunks;
+        if constexpr (std::is_same<Partition, grainsize>::value) chunks = std::max<unsigned long long>(iterations / std::max<size_t>(partition.iterations, 1), 1);
+        else
+        {
+            static_assert(std::is_same<Partition, num_tasks>::value, "the partition is MiniRun::grainsize or MiniRun::num_tasks");
+            chunks = std::min<unsigned long long>(std::max<size_t>(partition.chunks, 1), iterations);
+        }
 
+        for (unsigned long long chunk = 0; chunk < chunks; ++chunk)
+        {
+            const T first = (T)(b + (T)(iterations * chunk / chunks));
+            const T last = (T)(b + (T)(iterations * (chunk + 1) / chunks));
+            createTask([body, first, last] {
+                if constexpr (std::is_invocable<const Body&, T, T>::value) body(first, last);
+                else for (T i = first; i < last; ++i) body(i);
+            }, in(first, last), out(first, last), group);
+        }
     }
 
     template<typename T, typename ActionFunction>//In c++20 should use concepts..
@@ -688,25 +4350,228 @@ public:
 
         if (group == maxGroup) taskwait(maxGroup);
     }
+
+    //Iterations per task chosen from the time per iteration measured in the previous tasks of the same call site (the
+    //type of the function, unique to its lambda expression), so that each task takes about the target. A range shorter
+    //than a target per thread is split in a task per thread instead, so it still keeps every thread busy.
+    struct auto_grain_t { std::chrono::nanoseconds target; };
+    static constexpr auto_grain_t auto_grain{ std::chrono::microseconds(50) };
+
+    template <typename T, typename ActionFunction>
+    inline void parallel_for(T b, T e, auto_grain_t policy, const ActionFunction& fun, group_t group = maxGroup)
+    {
+        static grain_site site;
+        if (!(e < b))
+        {
+            const unsigned long long iterations = (unsigned long long)(e - b) + 1;
+            const unsigned long long workers = (unsigned long long)numThreads() + 1;
+            const double perIteration = site.nanosPerIteration.load(std::memory_order_relaxed);
+            unsigned long long grain = iterations / (8 * workers); //first run, small tasks to learn the cost
+            if (perIteration > 0)
+            {
+                const unsigned long long target = (unsigned long long)(policy.target.count() / perIteration);
+                grain = std::min(target, (iterations + workers - 1) / workers);
+            }
+            grain = std::max(grain, 1ull);
+
+            for (unsigned long long first = 0; first < iterations; first += grain)
+            {
+                const unsigned long long count = std::min(grain, iterations - first);
+                createTask([fun, start = (T)(b + (T)first), count] {
+                    const int64_t begin = threadCpuNanoseconds();
+                    for (unsigned long long i = 0; i < count; ++i) fun((T)(start + (T)i));
+                    site.record(count, threadCpuNanoseconds() - begin);
+                }, group);
+            }
+        }
+
+        if (group == maxGroup) taskwait(maxGroup);
+    }
 public:
-    template<typename... T> static dep_list_t deps(const T&... params) { return { (uintptr_t)std::is_pointer<T>::value ? (uintptr_t)params : (uintptr_t)&params... }; }
-    MiniRun() :_pool(), _global_running_tasks(0) {}
-    MiniRun(int numThreads) : _pool(numThreads), _global_running_tasks(0) {}
-    ~MiniRun() { taskwait(); while (!_preallocatedTasks.empty()) { delete _preallocatedTasks.front(); _preallocatedTasks.pop(); } }
+    //Pointers are tracked by their value, objects with a dep_key() member by its result and anything else by its address
+    template<typename T>
+    static inline dep_t depKey(const T& param)
+    {
+        if constexpr (std::is_pointer<T>::value) return (dep_t)param;
+        else if constexpr (hasDepKey<T>::value) return param.dep_key();
+        else return (dep_t)&param;
+    }
+
+    template<typename... T> static dep_list_t deps(const T&... params) { return { depKey(params)... }; }
+    struct shared_pool_t {};
+    static constexpr shared_pool_t shared{};
+
+    //The environment variable MINIRUN_SHARED_POOL makes the default constructed runtimes use the shared pool
+    MiniRun() : _global_running_tasks(0)
+    {
+        if (sharedPoolByDefault()) _pool = &sharedPool();
+        else _pool = (_ownPool = std::unique_ptr<ThreadPool>(new ThreadPool())).get();
+        attach();
+    }
+
+    MiniRun(int numThreads) : _ownPool(new ThreadPool(numThreads)), _pool(_ownPool.get()), _global_running_tasks(0) { attach(); }
+
+    //Attaches the runtime to the process wide pool, the weight is the share of the threads when several runtimes have ready tasks,
+    //and the quota limits the number of its tasks running at the same time in the pool threads (0 is unlimited)
+    MiniRun(shared_pool_t, num_tasks_t weight = 1, num_tasks_t quota = 0) : _pool(&sharedPool()), _global_running_tasks(0)
+    {
+        _client._weight = std::max<num_tasks_t>(weight, 1);
+        _client._quota = quota;
+        attach();
+    }
+
+    ~MiniRun() { unregister<MiniRun*>(introspection().runtimes, this); waitAllTasks(); _pool->detach(&_client); while (!_preallocatedTasks.empty()) { delete _preallocatedTasks.front(); _preallocatedTasks.pop(); } }
 
 
 private:
 
-    ThreadPool _pool;
-    SpinLock _sentinel_map_group_lock, _running_tasks_group_lock;
+    inline void attach()
+    {
+        _pool->attach(&_client);
+        std::lock_guard<std::mutex> guard(introspection().mtx);
+        introspection().runtimes.push_back(this);
+    }
+
+    //Called by dumpState with the registry locked, the counters are read while the runtime keeps running
+    inline void dumpRuntime(std::ostream& out, int64_t now)
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "runtime %p: %lld tasks in flight\n", (void*)this, (long long)_global_running_tasks.load());
+        out << line;
+
+        std::vector<std::pair<group_t, group_state*>> groups;
+        {
+            lock_guard guard(_running_tasks_group_lock);
+            for (auto& group : _groups) groups.emplace_back(group.first, &group.second);
+        }
+        std::sort(groups.begin(), groups.end());
+        for (auto& group : groups)
+        {
+            const num_tasks_t inFlight = group.second->_running.load();
+            const size_t ready = _pool->readyTasks(*group.second);
+            num_tasks_t running = 0;
+            int64_t oldest = 0;
+            for (thread_record* record : introspection().threads)
+            {
+                const int64_t since = record->since.load(std::memory_order_relaxed);
+                if (since == 0 || record->runtime.load(std::memory_order_relaxed) != this || record->group.load(std::memory_order_relaxed) != group.first) continue;
+                running++;
+                oldest = std::max(oldest, now - since);
+            }
+            snprintf(line, sizeof(line), "  group %u: %lld in flight, %zu ready, %lld running (oldest %.3f ms), %lld waiting for dependences or executors, weight %lld%s%s\n",
+                group.first, (long long)inFlight, ready, (long long)running, oldest / 1e6, (long long)std::max<num_tasks_t>(inFlight - (num_tasks_t)ready - running, 0),
+                (long long)group.second->_weight, group.second->_latency ? ", latency class" : "", group.second->_cancelled.load() ? ", cancelled" : "");
+            out << line;
+        }
+
+        //Addresses with accesses that have not finished, copied first so the map is locked for a short time
+        std::vector<std::pair<group_t, std::pair<SpinLock, sentinel_map_type>*>> maps;
+        {
+            lock_guard guard(_sentinel_map_group_lock);
+            for (auto& map : _sentinel_value_map) maps.emplace_back(map.first, &map.second);
+        }
+        for (auto& map : maps)
+        {
+            std::vector<std::pair<dep_t, uint32_t>> pending;
+            {
+                lock_guard guard(map.second->first);
+                for (auto& sentinel : map.second->second)
+                {
+                    const uint32_t count = sentinel.second._registered.load(std::memory_order_relaxed) - sentinel.second._completed.load(std::memory_order_relaxed);
+                    if (count != 0 && sentinel.second._last.load(std::memory_order_relaxed) != nullptr) pending.emplace_back(sentinel.first, count);
+                }
+            }
+            for (auto& sentinel : pending)
+            {
+                snprintf(line, sizeof(line), "    group %u address %p: %u pending accesses\n", map.first, (void*)sentinel.first, sentinel.second);
+                out << line;
+            }
+        }
+    }
+
+#if defined(MINIRUN_SIGNAL_DUMP)
+    //Only writes to the pipe, which is async-signal-safe, the dump is written by the dumper thread
+    static void dumpSignalHandler(int)
+    {
+        const int savedErrno = errno;
+        ssize_t written = write(introspection().pipe[1], "d", 1);
+        (void)written;
+        errno = savedErrno;
+    }
+
+    static void dumperThread()
+    {
+        introspection_registry& registry = introspection();
+        char request;
+        while (true)
+        {
+            const ssize_t bytes = read(registry.pipe[0], &request, 1);
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes <= 0) return;
+
+            std::string path;
+            {
+                std::lock_guard<std::mutex> guard(registry.mtx);
+                path = registry.path;
+            }
+            std::ofstream out(path, std::ios::app);
+            dumpState(out);
+        }
+    }
+#endif
+
+    //The shared pool has a thread less than the cores, as the default runtime, the threads waiting on each runtime also run its tasks
+    static inline ThreadPool& sharedPool()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    static num_tasks_t defaultMaxInFlightTasks()
+    {
+        static num_tasks_t maxInFlight = []() -> num_tasks_t {
+            char value[32];
+            size_t requiredSize;
+            getenv_s(&requiredSize, value, sizeof(value), "MINIRUN_MAX_IN_FLIGHT_TASKS");
+            return requiredSize != 0 && requiredSize < sizeof(value) ? std::max<num_tasks_t>(atoll(value), 0) : 0;
+        }();
+        return maxInFlight;
+    }
+
+    static bool sharedPoolByDefault()
+    {
+        static bool shared = []() {
+            size_t requiredSize;
+            getenv_s(&requiredSize, NULL, 0, "MINIRUN_SHARED_POOL");
+            return requiredSize != 0;
+        }();
+        return shared;
+    }
+
+    std::unique_ptr<ThreadPool> _ownPool;
+    ThreadPool*                 _pool;
+    ThreadPool::client          _client;
+    SpinLock _sentinel_map_group_lock{ lock_site::sentinelGroups }, _running_tasks_group_lock{ lock_site::groups };
     std::atomic<num_tasks_t>                               _global_running_tasks;
     std::unordered_map<group_t, std::pair<SpinLock, sentinel_map_type>>  _sentinel_value_map;
-    std::unordered_map<group_t, std::atomic<num_tasks_t> > _running_tasks;
+    std::unordered_map<group_t, group_state>               _groups;
     std::unordered_map<group_t, SpinLock>                  _group_lock;
     bool _minirunDisabled = minirunDisabled();
+    std::atomic<num_tasks_t> _max_in_flight_tasks{ defaultMaxInFlightTasks() };
+    std::atomic<int64_t>         _autoInlineNanos{ 0 };
+    std::unique_ptr<call_site[]> _callSites; //created by the first setAutoInline
+
+#if defined(MINIRUN_FILE_IO)
+    std::once_flag           _ioEngineOnce;
+    std::unique_ptr<IoEngine> _ioEngine; //created with the first I/O task
+#endif
 
     //tasks
-    SpinLock          _preallocTasksMtx;
+    SpinLock          _preallocTasksMtx{ lock_site::preallocatedTasks };
     std::queue<Task*> _preallocatedTasks;
 
+    static inline thread_local Task* _current_task = nullptr; //task being executed by this thread
+    static inline thread_local group_state* _inlineGroup = nullptr; //group of the body run inline by this thread, see runInline
+    static inline thread_local const MiniRun* _finalRuntime = nullptr; //runtime of the final task being executed by this thread
+
 };
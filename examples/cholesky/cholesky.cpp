@@ -9,72 +9,59 @@
 #include "cholesky.hpp"
 
 #define VERBOSE
-constexpr int NUM_THREADS = 8;
-MiniRun runtime(NUM_THREADS-1);
 
-void omp_potrf(MiniRun& runtime, double * const A, int ts, int ld)
+using tile = MiniRun::tile_view<double>;
+
+void omp_potrf(MiniRun& runtime, tile A)
 {
-   static int INFO;
-   static char L = 'L';
-   
    const auto OUT = MiniRun::deps(A);
-   runtime.createTask([=](){dpotrf_(&L, &ts, A, &ld, &INFO);},{},OUT);
+   runtime.createTask([=](){ MiniKernels::potrf(A.rows, A.data, A.ld); },{},OUT);
 }
 
-void omp_trsm(MiniRun& runtime, double *A, double *B, int ts, int ld)
+void omp_trsm(MiniRun& runtime, tile A, tile B)
 {
-   static char LO = 'L', TR = 'T', NU = 'N', RI = 'R';
-   static double DONE = 1.0;
-   
    const auto IN  = MiniRun::deps(A);
    const auto OUT = MiniRun::deps(B);
-   runtime.createTask([=](){dtrsm_(&RI, &LO, &TR, &NU, &ts, &ts, &DONE, A, &ld, B, &ld );}, IN, OUT);
-   
+   runtime.createTask([=](){ MiniKernels::trsm(B.rows, B.cols, A.data, A.ld, B.data, B.ld); }, IN, OUT);
 }
 
-void omp_syrk(MiniRun& runtime, double *A, double *B, int ts, int ld)
+void omp_syrk(MiniRun& runtime, tile A, tile B)
 {
-   static char LO = 'L', NT = 'N';
-   static double DONE = 1.0, DMONE = -1.0;
    const auto IN  = MiniRun::deps(A);
    const auto OUT = MiniRun::deps(B);
-   runtime.createTask([=](){dsyrk_(&LO, &NT, &ts, &ts, &DMONE, A, &ld, &DONE, B, &ld );}, IN, OUT);
-
+   runtime.createTask([=](){ MiniKernels::syrk(B.rows, A.cols, -1.0, A.data, A.ld, B.data, B.ld); }, IN, OUT);
 }
 
-void omp_gemm(MiniRun& runtime, double *A, double *B, double *C, int ts, int ld)
+void omp_gemm(MiniRun& runtime, tile A, tile B, tile C)
 {
-   static const char TR = 'T', NT = 'N';
-   static double DONE = 1.0, DMONE = -1.0;
    const auto IN  = MiniRun::deps(A,B);
    const auto OUT = MiniRun::deps(C);
-   runtime.createTask([=](){dgemm_(&NT, &TR, &ts, &ts, &ts, &DMONE, A, &ld, B, &ld, &DONE, C, &ld);}, IN, OUT);
+   runtime.createTask([=](){ MiniKernels::gemm(true, C.rows, C.cols, A.cols, -1.0, A.data, A.ld, B.data, B.ld, C.data, C.ld); }, IN, OUT);
 }
 
-void cholesky_blocked(int numThreads, const int ts, const int nt, double** Ah)
+void cholesky_blocked(MiniRun& runtime, MiniRun::TileMatrix<double>& A)
 {
-   MiniRun runtime(numThreads);
-   const auto ah = [&](auto i, auto j)->double*{ return Ah[nt*i+j]; };	
+   const int nt = A.rowTiles();
    for (int k = 0; k < nt; k++) {
 
       // Diagonal Block factorization
-      omp_potrf (runtime, ah(k,k), ts, ts);
+      omp_potrf (runtime, A(k,k));
 
       // Triangular systems
       for (int i = k + 1; i < nt; i++) {
-         omp_trsm (runtime, ah(k,k), ah(k,i), ts, ts);
+         omp_trsm (runtime, A(k,k), A(i,k));
       }
 
       // Update trailing matrix
       for (int i = k + 1; i < nt; i++) {
          for (int j = k + 1; j < i; j++) {
-            omp_gemm (runtime, ah(k,i), ah(k,j), ah(j,i), ts, ts);
+            omp_gemm (runtime, A(i,k), A(j,k), A(i,j));
          }
-         omp_syrk (runtime, ah(k,i), ah(i,i), ts, ts);
+         omp_syrk (runtime, A(i,k), A(i,i));
       }
 
    }
-   //implicit taskwait
+   runtime.taskwait();
 }
 
 int main(int argc, char* argv[])
@@ -104,17 +91,10 @@ int main(int argc, char* argv[])
    double * const original_matrix = (double *) malloc(n * n * sizeof(double));
    assert(original_matrix != NULL);
 
-   const int nt = n / ts;
+   MiniRun runtime(numThreads);
 
    // Allocate blocked matrix
-   double *Ah[nt][nt];
-
-   for (int i = 0; i < nt; i++) {
-      for (int j = 0; j < nt; j++) {
-         Ah[i][j] = (double*) malloc(ts * ts * sizeof(double));
-         assert(Ah[i][j] != NULL);
-      }
-   }
+   MiniRun::TileMatrix<double> A(runtime, n, n, ts);
 
    for (int i = 0; i < n * n; i++ ) {
       original_matrix[i] = matrix[i];
@@ -124,13 +104,18 @@ int main(int argc, char* argv[])
    printf ("Executing ...\n");
 #endif
 
-   convert_to_blocks(ts, nt, n, (double*) matrix, (double**) Ah);
+   const float t0 = get_time();
+   A.fromColumnMajor(matrix, n);
+   runtime.taskwait();
 
    const float t1 = get_time();
-   cholesky_blocked( numThreads,ts, nt, (double**) Ah);
+   cholesky_blocked(runtime, A);
 
    const float t2 = get_time() - t1;
-   convert_to_linear(ts, nt, n, (double**) Ah, (double*) matrix);
+   const float t3 = get_time();
+   A.toColumnMajor(matrix, n);
+   runtime.taskwait();
+   const float conversion = (t1 - t0) + (get_time() - t3);
 
    if ( check ) {
       const char uplo = 'L';
@@ -147,23 +132,17 @@ int main(int argc, char* argv[])
    printf( "============ CHOLESKY RESULTS ============\n" );
    printf( "  matrix size:          %dx%d\n", n, n);
    printf( "  block size:           %dx%d\n", ts, ts);
-   printf( "  number of threads:    %d\n", NUM_THREADS);
+   printf( "  number of threads:    %d\n", numThreads);
+   printf( "  kernels:              %s\n", MiniKernels::isaName());
    printf( "  time (s):             %f\n", time);
+   printf( "  conversion time (s):  %f\n", conversion);
    printf( "  performance (gflops): %f\n", gflops);
    printf( "  result :              %s\n",  result[check]);
    printf( "==========================================\n" );
 #else
-   printf( "test:%s-%d-%d:threads:%2d:result:%s:gflops:%f\n", argv[0], n, ts, NUM_THREADS, result[check], gflops );
+   printf( "test:%s-%d-%d:threads:%2d:result:%s:gflops:%f\n", argv[0], n, ts, numThreads, result[check], gflops );
 #endif
 
-   // Free blocked matrix
-   for (int i = 0; i < nt; i++) {
-      for (int j = 0; j < nt; j++) {
-         assert(Ah[i][j] != NULL);
-         free(Ah[i][j]);
-      }
-   }
-
    // Free matrix
    free(matrix);
 
@@ -1,45 +1,9 @@
 #include <cmath>
-#include <mkl.h>
+#include "MiniKernels.hpp"
 #include <sys/time.h>
 #include <sys/times.h>
 #include <math.h>       /* isnan, sqrt */
 
-#define dcopy_  DCOPY 
-#define dasum_  DASUM
-#define daxpy_  DAXPY
-#define dcabs1_ DCABS1
-#define ddot_   DDOT
-#define dgbmv_  DGBMV
-#define dgemm_  DGEMM
-#define dgemv_  DGEMV
-#define dger_   DGER
-#define dnrm2_  DNRM2
-#define drot_   DROT
-#define drotg_  DROTG
-#define dsbmv_  DSBMV
-#define dscal_  DSCAL
-#define dspmv_  DSPMV
-#define dspr_   DSPR
-#define dspr2_  DSPR2
-#define dswap_  DSWAP
-#define dsymm_  DSYMM
-#define dsymv_  DSYMV
-#define dsyr_   DSYR
-#define dsyr2_  DSYR2
-#define dsyr2k_ DSYR2K
-#define dsyrk_  DSYRK
-#define dtbmv_  DTBMV
-#define dtbsv_  DTBSV
-#define dtpmv_  DTPMV
-#define dtpsv_  DTPSV
-#define dtrmm_  DTRMM
-#define dtrmv_  DTRMV
-#define dtrsm_  DTRSM
-#define dtrsv_  DTRSV
-#define dzasum_ DZASUM
-#define dznrm2_ DZNRM2
-#define idamax_ IDAMAX
-
 enum blas_order_type {
             blas_rowmajor = 101,
             blas_colmajor = 102 };
@@ -190,43 +154,46 @@ float get_time()
 // Robust Check the factorization of the matrix A2
 static int check_factorization(int N, double *A1, double *A2, int LDA, char uplo, double eps)
 {
-	char NORM = 'I', ALL = 'A', UP = 'U', LO = 'L', TR = 'T', NU = 'N', RI = 'R';
-
 #ifdef VERBOSE
 	printf ("Checking result ...\n");
 #endif
 
 	double *Residual = (double *)malloc(N*N*sizeof(double));
 	double *L1       = (double *)malloc(N*N*sizeof(double));
-	double *L2       = (double *)malloc(N*N*sizeof(double));
-	double *work     = (double *)malloc(N*sizeof(double));
 
 	memset((void*)L1, 0, N*N*sizeof(double));
-	memset((void*)L2, 0, N*N*sizeof(double));
 
-	double alpha= 1.0;
-
-	dlacpy_(&ALL, &N, &N, A1, &LDA, Residual, &N);
+	/* Copy the triangle of the factor, the residual starts as -A */
+	for (int j = 0; j < N; j++)
+		for (int i = 0; i < N; i++) {
+			if ((uplo == 'U') ? (i <= j) : (i >= j)) L1[j*N+i] = A2[j*LDA+i];
+			Residual[j*N+i] = -A1[j*LDA+i];
+		}
 
-	/* Dealing with L'L or U'U  */
-	if (uplo == 'U'){
-		dlacpy_(&UP, &N, &N, A2, &LDA, L1, &N);
-		dlacpy_(&UP, &N, &N, A2, &LDA, L2, &N);
-		dtrmm_(&LO, &uplo, &TR, &NU, &N, &N, &alpha, L1, &N, L2, &N);
+	/* Compute the Residual || L'L - A || (or U'U) */
+	if (uplo == 'U') {
+		double *U = (double *)malloc(N*N*sizeof(double));
+		for (int j = 0; j < N; j++)
+			for (int i = 0; i < N; i++)
+				U[i*N+j] = L1[j*N+i];
+		MiniKernels::gemm(true, N, N, N, 1.0, U, N, U, N, Residual, N);
+		free(U);
 	}
-	else{
-		dlacpy_(&LO, &N, &N, A2, &LDA, L1, &N);
-		dlacpy_(&LO, &N, &N, A2, &LDA, L2, &N);
-		dtrmm_(&RI, &LO, &TR, &NU, &N, &N, &alpha, L1, &N, L2, &N);
+	else {
+		MiniKernels::gemm(true, N, N, N, 1.0, L1, N, L1, N, Residual, N);
 	}
 
-	/* Compute the Residual || A -L'L|| */
-	for (int i = 0; i < N; i++)
-		for (int j = 0; j < N; j++)
-			Residual[j*N+i] = L2[j*N+i] - Residual[j*N+i];
-
-	double Rnorm = dlange_(&NORM, &N, &N, Residual, &N, work);
-	double Anorm = dlange_(&NORM, &N, &N, A1, &N, work);
+	const auto inf_norm = [N](const double *M, int ld) {
+		double norm = 0.0;
+		for (int i = 0; i < N; i++) {
+			double row = 0.0;
+			for (int j = 0; j < N; j++) row += fabs(M[j*ld+i]);
+			norm = std::max(norm, row);
+		}
+		return norm;
+	};
+	double Rnorm = inf_norm(Residual, N);
+	double Anorm = inf_norm(A1, LDA);
 
 #ifdef VERBOSE
 	printf("============\n");
@@ -247,22 +214,23 @@ static int check_factorization(int N, double *A1, double *A2, int LDA, char uplo
 	}
 #endif
 
-	free(Residual); free(L1); free(L2); free(work);
+	free(Residual); free(L1);
 
 	return info_factorization;
 }
 
 void initialize_matrix(int n, const int ts, double *matrix)
 {
-	int ISEED[4] = {0,0,0,1};
-	int intONE=1;
+	unsigned long long seed = 1;
 
 #ifdef VERBOSE
 	printf("Initializing matrix with random values ...\n");
 #endif
 
-	for (int i = 0; i < n*n; i+=n) {
-		dlarnv_(&intONE, &ISEED[0], &n, &matrix[i]);
+	/* Uniform values in (0,1) */
+	for (int i = 0; i < n*n; i++) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		matrix[i] = ((seed >> 11) + 0.5) * (1.0 / 9007199254740992.0);
 	}
 
 	for (int i=0; i<n; i++) {
@@ -275,50 +243,3 @@ void initialize_matrix(int n, const int ts, double *matrix)
 	add_to_diag(matrix, n, (double) n);
 }
 
-static void gather_block(const int N, const int ts, double *Alin, double *A)
-{
-	for (int i = 0; i < ts; i++)
-		for (int j = 0; j < ts; j++) {
-			A[i*ts + j] = Alin[i*N + j];
-		}
-}
-
-static void scatter_block(const int N, const int ts, double *A, double *Alin)
-{
-	for (int i = 0; i < ts; i++)
-		for (int j = 0; j < ts; j++) {
-			Alin[i*N + j] = A[i*ts + j];
-		}
-}
-
-static void convert_to_blocks(const int ts, const int DIM, const int N, double *Alin, double **A)
-{
-	const auto alin = [&](auto i, auto j)->auto&{ return Alin[N*i+j]; };	
-	const auto a = [&](auto i, auto j)->double*{ return A[DIM*i+j]; };	
-	for (int i = 0; i < DIM; i++)
-		for (int j = 0; j < DIM; j++) {
-			gather_block ( N, ts, &alin(i*ts,j*ts), a(i,j));
-		}
-}
-
-static void convert_to_linear(const int ts, const int DIM, const int N, double **A, double *Alin)
-{
-
-	const auto alin = [&](auto i, auto j)->auto&{ return Alin[N*i+j]; };	
-	const auto a = [&](auto i, auto j)->double*{ return A[DIM*i+j]; };	
-	for (int i = 0; i < DIM; i++)
-		for (int j = 0; j < DIM; j++) {
-			scatter_block ( N, ts, a(i,j), &alin(i*ts,j*ts));
-		}
-}
-
-static double * malloc_block (const int ts)
-{
-	double * const block = (double *) malloc(ts * ts * sizeof(double));
-    assert(block != NULL);
-
-	return block;
-}
-
-
-
@@ -23,11 +23,12 @@ void check(bool& checkValid, float* buffer, float xv, float yv, float addVal, in
 
 int main()
 {
-    MiniRun run(5);
-
     int N = 1 << 10;
 
     int device = 0;
+    MiniRun::Executor gpu("gpu0", [=]() { setActive(device); }); //the device is made current once, in the thread of the executor
+    MiniRun run(5);
+
     float initXval = 2;
     float initYval = 2;
     float addVal = 2;
@@ -43,19 +44,17 @@ int main()
 
     run.createTask([&]() { initialize(x, initXval, N); }, {}, MiniRun::deps(x));
     run.createTask([&]() { initialize(y, initYval, N); }, {}, MiniRun::deps(y));
-    run.createTask([&]() { setActive(device); copyToDevice(d_x, x, N*sizeof(float), stream); }, MiniRun::deps(x), MiniRun::deps(d_x));
-    run.createTask([&]() { setActive(device); copyToDevice(d_y, y, N*sizeof(float), stream); }, MiniRun::deps(y), MiniRun::deps(d_y));
-    run.createTask([&]() { setActive(device); saxpy(N, d_x, d_y, addVal, stream); }, MiniRun::deps(d_x), MiniRun::deps(d_y));
+    run.createTask([&]() { copyToDevice(d_x, x, N*sizeof(float), stream); }, MiniRun::deps(x), MiniRun::deps(d_x), gpu);
+    run.createTask([&]() { copyToDevice(d_y, y, N*sizeof(float), stream); }, MiniRun::deps(y), MiniRun::deps(d_y), gpu);
+    run.createTask([&]() { saxpy(N, d_x, d_y, addVal, stream); }, MiniRun::deps(d_x), MiniRun::deps(d_y), gpu);
 
     run.createTask(
         [&]() {
-            setActive(device);
             copyToHost(y, d_y, N * sizeof(float), stream);
         },
         [&]() {
-            setActive(device);
             return streamEmpty(stream); //since we have enqueued all into a stream...
-        }, MiniRun::deps(d_y), MiniRun::deps(y));
+        }, MiniRun::deps(d_y), MiniRun::deps(y), gpu);
 
     run.createTask([&]() {check(valid, y, initXval, initYval, addVal, N); }, MiniRun::deps(y), MiniRun::deps(valid));
     run.taskwait();
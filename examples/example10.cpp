@@ -0,0 +1,50 @@
+// Elastic pool. In the automatic mode the pool starts small, grows while a burst of tasks keeps its workers busy and
+// retires the workers once the burst is over. The maximum is also capped by the cpus available to the process, so on a
+// small machine the pool may not grow at all.
+
+#include "MiniRun.hpp"
+
+#include <cstdio>
+#include <chrono>
+#include <thread>
+
+int main()
+{
+    MiniRun run(1);
+
+    const int minThreads = 1, maxThreads = 8;
+    const unsigned burst = 1;
+    run.setAutoThreads(minThreads, maxThreads);
+
+    //A burst of tasks of a millisecond each, the main thread only watches the size of the pool
+    std::atomic<int> finished{ 0 };
+    for (int i = 0; i < 2000; ++i)
+        run.createTask([&] {
+            const auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+            while (std::chrono::steady_clock::now() < end);
+            finished++;
+        }, burst);
+
+    int peak = run.numThreads();
+    while (!run.try_taskwait(burst))
+    {
+        peak = std::max(peak, run.numThreads());
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    printf("burst of %d tasks: the pool grew from %d to %d workers (at most %d)\n", finished.load(), minThreads, peak, maxThreads);
+
+    //Without ready tasks a worker is retired every half a second until the minimum is reached
+    const auto start = std::chrono::steady_clock::now();
+    while (run.numThreads() > minThreads && std::chrono::steady_clock::now() - start < std::chrono::seconds(10))
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("idle: back to %d workers after %.1f seconds\n", run.numThreads(), seconds);
+
+    //A fixed size leaves the automatic mode
+    run.setNumThreads(2);
+    printf("fixed size: %d workers\n", run.numThreads());
+
+    const bool ok = finished == 2000 && peak >= minThreads && peak <= maxThreads && seconds < 10 && run.numThreads() == 2;
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
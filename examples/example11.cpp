@@ -0,0 +1,56 @@
+// Scratch memory. Each task sorts a block of values in a workspace taken from the arena of its thread, which is
+// released when the task finishes, and keeps its summary in a MiniRun::Arena that outlives the tasks. The main thread
+// releases its own scratch memory with a scratch_scope.
+
+#include "MiniRun.hpp"
+
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+
+struct Summary
+{
+    int min, median, max;
+};
+
+int main()
+{
+    MiniRun run(4);
+
+    const int blocks = 1000;
+    const int blockSize = 4096;
+    std::vector<int> values((size_t)blocks * blockSize);
+    for (size_t i = 0; i < values.size(); ++i) values[i] = (int)((i * 2654435761u) % 100000);
+
+    MiniRun::Arena results;
+    std::vector<Summary*> summaries(blocks);
+    std::atomic<int> misaligned{ 0 };
+    for (int block = 0; block < blocks; ++block)
+        run.createTask([&, block] {
+            int* work = MiniRun::scratch<int>(blockSize, 64); //not initialized, released with the task
+            if ((uintptr_t)work % 64 != 0) misaligned++;
+            std::copy_n(values.data() + (size_t)block * blockSize, blockSize, work);
+            std::sort(work, work + blockSize);
+            summaries[block] = new (results.allocate<Summary>(1)) Summary{ work[0], work[blockSize / 2], work[blockSize - 1] };
+        });
+    run.taskwait();
+
+    //Outside of tasks the memory lasts until the end of the enclosing scope
+    int wrong = 0;
+    {
+        MiniRun::scratch_scope scope;
+        int* work = MiniRun::scratch<int>(blockSize);
+        for (int block = 0; block < blocks; ++block)
+        {
+            std::copy_n(values.data() + (size_t)block * blockSize, blockSize, work);
+            std::sort(work, work + blockSize);
+            const Summary& summary = *summaries[block];
+            if (summary.min != work[0] || summary.median != work[blockSize / 2] || summary.max != work[blockSize - 1]) wrong++;
+        }
+    }
+    printf("%d blocks of %d values: %d summaries differ from the serial ones, %d misaligned workspaces\n", blocks, blockSize, wrong, misaligned.load());
+
+    const bool ok = wrong == 0 && misaligned == 0;
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -1,17 +1,17 @@
 #include "MiniRun.hpp"
+#include "MiniKernels.hpp"
 
 using matrix_type = float;
 
 
 void matmul(MiniRun& runtime, const size_t size, const matrix_type *a, const matrix_type *b,  matrix_type *c)
 {
+    //The blocks are row major, so in column major terms the kernel computes c^T += b^T * a^T
     runtime.createTask(
         [=]()
         {
-            for(size_t k=0; k < size; ++k)
-                for(size_t i=0; i < size; ++i)
-                 for(size_t j=0; j < size; ++j)
-                    c[i*size + j] += a[i*size + k] * b[k*size + j];
+            const int n = (int)size;
+            MiniKernels::gemm(false, n, n, n, 1.0f, b, n, a, n, c, n);
         }, MiniRun::deps(a,b), MiniRun::deps(c));
 }
 
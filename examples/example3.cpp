@@ -0,0 +1,40 @@
+// Same computation as example1, but the results are passed between tasks with futures and continuations.
+
+#include "MiniRun.hpp"
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <numeric>
+
+int calcDotProduct(const std::vector<int>& a, const std::vector<int>& b)
+{
+  return std::inner_product(a.begin(), a.end(), b.begin(), 0);
+}
+
+double calcMagnitude(const std::vector<int>& a)
+{
+  return std::sqrt(calcDotProduct(a, a));
+}
+
+int main()
+{
+  const std::vector<int> v1 { 2, -4, 7 };
+  const std::vector<int> v2 { 5, 1, -3 };
+
+  MiniRun run(4);
+  auto v1v2Dot     = run.createTask([&](){ return calcDotProduct(v1, v2); });
+  auto v1Magnitude = run.createTask([&](){ return calcMagnitude(v1); });
+  auto v2Magnitude = run.createTask([&](){ return calcMagnitude(v2); });
+
+  auto result = MiniRun::when_all(v1v2Dot, v1Magnitude, v2Magnitude).then([](auto& inputs){
+      return std::acos((double)std::get<0>(inputs).get() / (std::get<1>(inputs).get() * std::get<2>(inputs).get()));
+  });
+
+  std::cout << "Angle between the vectors: "
+            << result.get()
+            << " radians."
+            << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,27 @@
+// Fibonacci with coroutine tasks, requires C++20. The waiting frames are suspended instead of blocking the threads.
+
+#include "MiniRun.hpp"
+#include <cstdio>
+
+MiniRun run;
+std::atomic<int> group(1);
+
+MiniRun::Coroutine fib(int n, long& out)
+{
+    if (n < 2) { out = n; co_return; }
+    long i, j;
+    int a_group = group++;
+    run.createTask(fib(n - 1, i), a_group);
+    run.createTask(fib(n - 2, j), a_group);
+    co_await run.async_taskwait(a_group);
+    out = i + j;
+}
+
+int main()
+{
+    const int n = 25;
+    long result;
+    run.createTask(fib(n, result));
+    run.taskwait();
+    printf("fib(%d) = %ld\n", n, result);
+}
@@ -0,0 +1,46 @@
+// Pipeline over a stream of text records: parse (serial), transform (parallel) and emit (serial, in order).
+// At most 16 records are in flight and their buffers are reused, so the stream does not allocate per record.
+
+#include "MiniRun.hpp"
+
+#include <cstdio>
+#include <string>
+#include <cmath>
+
+struct Record
+{
+    std::string line;
+    long        key;
+    double      value;
+};
+
+int main()
+{
+    MiniRun run(4);
+
+    const long numRecords = 1000000;
+    long next = 0;
+    double total = 0;
+
+    run.pipeline<Record>(16)
+        .source([&](Record& record) {
+            if (next == numRecords) return false;
+            record.line = std::to_string(next++) + ",1.5";
+            return true;
+        })
+        .stage(MiniRun::serial_in_order, [](Record& record) {
+            record.key = std::stol(record.line);
+            record.value = std::stod(record.line.substr(record.line.find(',') + 1));
+        })
+        .stage(MiniRun::parallel, [](Record& record) {
+            record.value = std::sqrt(record.value * record.key);
+        })
+        .stage(MiniRun::serial_in_order, [&](Record& record) {
+            total += record.value;
+            if (record.key % 250000 == 0) printf("record %ld: %f\n", record.key, record.value);
+        })
+        .run();
+
+    printf("total: %f\n", total);
+    return 0;
+}
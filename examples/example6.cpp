@@ -0,0 +1,53 @@
+// 1D heat stencil with taskloop. Each chunk of step t+1 depends on the chunks of step t that it reads (itself and
+// its two neighbours), so a chunk starts as soon as its neighbours are done, without a barrier between the steps.
+
+#include "MiniRun.hpp"
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+int main()
+{
+    MiniRun run(4);
+
+    const long size = 1 << 20;
+    const long chunk = 1 << 14;   //divides the size, so every chunk starts at a multiple of it
+    const int steps = 100;
+
+    std::vector<double> a(size), b(size);
+    for (long i = 0; i < size; ++i) a[i] = b[i] = std::sin(i * 0.001);
+    std::vector<double> reference = a;
+
+    double* grids[2] = { a.data(), b.data() };
+    for (int step = 0; step < steps; ++step)
+    {
+        const double* from = grids[step % 2];
+        double* to = grids[(step + 1) % 2];
+
+        run.taskloop(0L, size, MiniRun::grainsize{ chunk },
+            [=](long first, long last) {
+                for (long i = std::max(first, 1L); i < std::min(last, size - 1); ++i)
+                    to[i] = 0.25 * from[i - 1] + 0.5 * from[i] + 0.25 * from[i + 1];
+            },
+            [=](long first, long) { return MiniRun::deps(&from[std::max(first - chunk, 0L)], &from[first], &from[std::min(first + chunk, size - chunk)]); },
+            [=](long first, long) { return MiniRun::deps(&to[first]); });
+    }
+    run.taskwait();
+
+    //Same sweep in serial
+    std::vector<double> other = reference;
+    for (int step = 0; step < steps; ++step)
+    {
+        std::vector<double>& from = step % 2 == 0 ? reference : other;
+        std::vector<double>& to = step % 2 == 0 ? other : reference;
+        for (long i = 1; i < size - 1; ++i) to[i] = 0.25 * from[i - 1] + 0.5 * from[i] + 0.25 * from[i + 1];
+    }
+
+    const std::vector<double>& result = steps % 2 == 0 ? a : b;
+    const std::vector<double>& expected = steps % 2 == 0 ? reference : other;
+    double error = 0;
+    for (long i = 0; i < size; ++i) error = std::max(error, std::abs(result[i] - expected[i]));
+    printf("%d steps of %ld points in chunks of %ld, max difference with the serial sweep %g\n", steps, size, chunk, error);
+    return error == 0 ? 0 : 1;
+}
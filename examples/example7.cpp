@@ -0,0 +1,61 @@
+// Cancellation and exceptions. A search group is cancelled while a chain of tasks is still waiting for its first one:
+// the pending tasks are dropped without running, while the tasks of another group that use the same buffer run as
+// usual. A task that throws makes the taskwait of its group rethrow the exception once the group has finished.
+
+#include "MiniRun.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+
+int main()
+{
+    MiniRun run(4);
+
+    const unsigned search = 1, other = 2, failing = 3;
+    long state = 0;
+    std::atomic<bool> started{ false };
+    std::atomic<int> skipped{ 0 }, ran{ 0 };
+
+    //The first task holds the buffer until the group is cancelled, the rest of the chain waits for it
+    run.createTask([&] {
+        started = true;
+        while (!MiniRun::isCancelled()) std::this_thread::yield();
+    }, MiniRun::deps(), MiniRun::deps(&state), search);
+    for (int i = 0; i < 100; ++i)
+        run.createTask([&] { skipped++; }, MiniRun::deps(&state), MiniRun::deps(&state), search);
+
+    //The dependences are tracked by group, so this chain does not wait for the cancelled one
+    long total = 0;
+    for (int i = 0; i < 100; ++i)
+        run.createTask([&] { total++; ran++; }, MiniRun::deps(&total), MiniRun::deps(&total), other);
+
+    while (!started) std::this_thread::yield();
+    run.cancel(search);
+    run.taskwait(search);
+    run.taskwait(other);
+    printf("cancelled group: %d of 100 pending tasks ran (expected 0)\n", skipped.load());
+    printf("other group: %d of 100 tasks ran, total %ld (expected 100)\n", ran.load(), total);
+
+    //The exception is captured by the runtime and the other tasks of the group still run
+    std::atomic<int> finished{ 0 };
+    for (int i = 0; i < 10; ++i)
+        run.createTask([&, i] {
+            if (i == 5) throw std::runtime_error("task 5 failed");
+            finished++;
+        }, failing);
+
+    bool caught = false;
+    try
+    {
+        run.taskwait(failing);
+    }
+    catch (const std::runtime_error& error)
+    {
+        caught = true;
+        printf("taskwait rethrew: %s, %d other tasks finished (expected 9)\n", error.what(), finished.load());
+    }
+
+    const bool ok = skipped == 0 && ran == 100 && total == 100 && caught && finished == 9;
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+// Renaming of a scratch buffer. Each step fills the buffer, corrects its first element and sums it. Without renaming
+// the fill of a step waits for the sum of the previous one; with it, the fill takes a free version of the buffer and
+// the steps overlap. The tasks reach the buffer through MiniRun::renamed.
+
+#include "MiniRun.hpp"
+
+#include <cstdio>
+#include <vector>
+
+int main()
+{
+    MiniRun run(4);
+
+    const int size = 1 << 16;
+    const int steps = 200;
+    std::vector<double> storage(size);
+    double* buffer = storage.data();
+    std::vector<double> sums(steps);
+
+    run.enableRenaming(buffer, size);
+    for (int step = 0; step < steps; ++step)
+    {
+        //Only writes the buffer, so it takes a version without pending readers and has to overwrite all of it
+        run.createTask([=] {
+            double* data = MiniRun::renamed(buffer);
+            for (int i = 0; i < size; ++i) data[i] = step;
+        }, MiniRun::deps(), MiniRun::deps(buffer));
+
+        //Changes a part of it, so it declares the buffer as in and out and gets the version of the fill
+        run.createTask([=] {
+            MiniRun::renamed(buffer)[0] = -step;
+        }, MiniRun::deps(buffer), MiniRun::deps(buffer));
+
+        run.createTask([=, &sums] {
+            const double* data = MiniRun::renamed(buffer);
+            double sum = 0;
+            for (int i = 0; i < size; ++i) sum += data[i];
+            sums[step] = sum;
+        }, MiniRun::deps(buffer), MiniRun::deps());
+    }
+    run.taskwait(); //copies the last version back to the buffer
+
+    int wrong = 0;
+    for (int step = 0; step < steps; ++step)
+        if (sums[step] != (double)step * (size - 1) - step) wrong++;
+    printf("%d steps: %d sums differ from the expected ones\n", steps, wrong);
+    printf("buffer after the taskwait: [0] = %g, [1] = %g (expected %d and %d)\n", buffer[0], buffer[1], -(steps - 1), steps - 1);
+
+    const bool ok = wrong == 0 && buffer[0] == -(steps - 1) && buffer[1] == steps - 1;
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,31 @@
+// Limit of the tasks in flight. A producer creates a million small tasks much faster than the workers run them; with
+// the limit, the creating thread runs tasks itself each time it reaches it, so the tasks kept in memory stay bounded.
+
+#include "MiniRun.hpp"
+
+#include <cstdio>
+
+int main()
+{
+    MiniRun run(4);
+
+    const long numTasks = 1000000;
+    const long limit = 1024;
+    std::atomic<long> finished{ 0 };
+    long peak = 0;
+
+    run.setMaxInFlightTasks(limit);
+    for (long i = 0; i < numTasks; ++i)
+    {
+        peak = std::max(peak, i - finished.load());
+        run.createTask([&] { finished++; });
+    }
+    run.taskwait();
+
+    printf("%ld tasks, at most %ld in flight while creating them (limit %ld), all finished: %s\n",
+        numTasks, peak, limit, finished == numTasks ? "yes" : "no");
+
+    const bool ok = peak <= limit && finished == numTasks;
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}